@@ -0,0 +1,259 @@
+// Benchmarks for the audio analysis and particle hot paths. Needs no window,
+// GL context or audio device, so it runs on build machines as well.
+//
+// Usage: carousel_bench [--quick] [FILE.ogg ...]
+//
+// Without files it uses the bundled ../assets/*.ogg (run from the build
+// directory, like carousel itself). Results go to stdout as JSON lines, one
+// object per measured configuration; progress and errors go to stderr.
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <vector>
+#include <glm/glm.hpp>
+#include "audio_features.h"
+#include "decoder.h"
+#include "particle_pool.h"
+#include "random.h"
+#include "spectrum.h"
+
+using benchClock = std::chrono::steady_clock;
+
+const int sampleRate = 44100;
+
+// Each configuration is timed this many times and the median pass reported,
+// which keeps a single scheduler hiccup from showing up as a regression
+const int passes = 5;
+
+struct Signal {
+    std::string name;
+    int sampleRate;
+    std::vector<float> samples;
+};
+
+static double secondsSince(benchClock::time_point start) {
+    return std::chrono::duration<double>(benchClock::now() - start).count();
+}
+
+static double median(std::vector<double> values) {
+    std::sort(values.begin(), values.end());
+    return values[values.size() / 2];
+}
+
+// Same 16-bit scale the player feeds the analysis, so dB levels match
+static Signal sineSweep(double seconds) {
+    Signal s{ "sweep", sampleRate, std::vector<float>(size_t(seconds * sampleRate)) };
+    double phase = 0.0;
+    for (size_t i = 0; i < s.samples.size(); ++i) {
+        double t = double(i) / s.samples.size();
+        double frequency = 30.0 * std::pow(16000.0 / 30.0, t);
+        phase += 2.0 * M_PI * frequency / sampleRate;
+        s.samples[i] = float(16000.0 * std::sin(phase));
+    }
+    return s;
+}
+
+static Signal whiteNoise(double seconds) {
+    Signal s{ "noise", sampleRate, std::vector<float>(size_t(seconds * sampleRate)) };
+    Xoshiro128Plus rng(1);
+    for (float& v : s.samples)
+        v = (rng.uniform() * 2.0f - 1.0f) * 16000.0f;
+    return s;
+}
+
+static bool decodeFile(const char* path, Signal& out) {
+    VorbisStream stream;
+    if (!stream.open(path))
+        return false;
+
+    out.name = path;
+    out.sampleRate = stream.sampleRate;
+    out.samples.clear();
+    out.samples.reserve(size_t(stream.lengthFrames));
+
+    std::vector<short> chunk(4096 * 2);
+    int frames;
+    while ((frames = stream.read(chunk.data(), 4096)) > 0) {
+        for (int i = 0; i < frames; ++i) {
+            float sum = 0.0f;
+            for (int c = 0; c < stream.channels; ++c)
+                sum += chunk[i * stream.channels + c];
+            out.samples.push_back(sum / stream.channels);
+        }
+    }
+    return !out.samples.empty();
+}
+
+// Window, FFT, log power, features and bar binning for every hop of the signal
+static void benchSpectrum(const Signal& signal, int fftSize, int numBars, BarScale scale, const char* scaleName) {
+    const int hop = fftSize / 4;
+    if ((int)signal.samples.size() < fftSize)
+        return;
+    const int hops = ((int)signal.samples.size() - fftSize) / hop + 1;
+
+    SpectrumAnalyzer analyzer(fftSize);
+    BarMapping mapping;
+    mapping.build(fftSize, signal.sampleRate, numBars, scale);
+
+    std::vector<float> heights(fftSize / 2);
+    std::vector<float> bars(numBars);
+    FeatureExtractor features;
+    AudioFeatures featureOut;
+    std::vector<double> analyseTimes, featureTimes, mapTimes;
+    float checksum = 0.0f;
+
+    for (int pass = 0; pass < passes; ++pass) {
+        features.configure(fftSize, signal.sampleRate, double(hop) / signal.sampleRate);
+        double analyseSeconds = 0.0, featureSeconds = 0.0, mapSeconds = 0.0;
+        for (int h = 0; h < hops; ++h) {
+            auto start = benchClock::now();
+            analyzer.analyse(signal.samples.data() + size_t(h) * hop, heights.data());
+            auto analysed = benchClock::now();
+            features.update(heights.data(), featureOut);
+            auto extracted = benchClock::now();
+            mapping.apply(heights.data(), bars.data());
+            auto end = benchClock::now();
+
+            analyseSeconds += std::chrono::duration<double>(analysed - start).count();
+            featureSeconds += std::chrono::duration<double>(extracted - analysed).count();
+            mapSeconds += std::chrono::duration<double>(end - extracted).count();
+            checksum += bars[h % numBars];
+        }
+        analyseTimes.push_back(analyseSeconds);
+        featureTimes.push_back(featureSeconds);
+        mapTimes.push_back(mapSeconds);
+    }
+
+    double analyseNs = median(analyseTimes) / hops * 1e9;
+    double featureNs = median(featureTimes) / hops * 1e9;
+    double mapNs = median(mapTimes) / hops * 1e9;
+    double frameNs = analyseNs + featureNs + mapNs;
+    double audioSeconds = double(hops) * hop / signal.sampleRate;
+    double realtime = audioSeconds / (frameNs * hops * 1e-9);
+
+    printf("{\"bench\":\"spectrum\",\"signal\":\"%s\",\"fft\":%d,\"hop\":%d,\"bars\":%d,\"scale\":\"%s\","
+           "\"frames\":%d,\"analyse_ns\":%.1f,\"features_ns\":%.1f,\"map_ns\":%.1f,\"ns_per_frame\":%.1f,"
+           "\"frames_per_sec\":%.0f,\"realtime_factor\":%.1f,\"checksum\":%.3f}\n",
+           signal.name.c_str(), fftSize, hop, numBars, scaleName, hops, analyseNs, featureNs, mapNs, frameNs,
+           1e9 / frameNs, realtime, checksum);
+}
+
+// Steady state of the CPU particle simulation at a given population: every
+// 60 Hz frame tops the pool back up with emit(), then runs update()
+static void benchParticles(int population, int frames) {
+    const float deltaTime = 1.0f / 60.0f;
+
+    ParticlePool particles(population);
+    Xoshiro128Plus emitRng;
+    std::vector<glm::vec3> positions(population);
+    Xoshiro128Plus rng(2);
+    for (auto& p : positions)
+        p = glm::vec3(rng.uniform() * 10.0f - 5.0f, 0.0f, rng.uniform() * 3.0f);
+
+    // Particles live two seconds; ramp up over that long so ages are spread
+    // out and each timed frame replaces the ones that just died
+    const int lifetimeFrames = 120;
+    for (int f = 0; f < lifetimeFrames; ++f) {
+        particles.emit(positions.data(), population / lifetimeFrames + 1, emitRng);
+        particles.update(deltaTime);
+    }
+
+    std::vector<double> emitTimes, updateTimes;
+    long long emitted = 0;
+
+    for (int pass = 0; pass < passes; ++pass) {
+        double emitSeconds = 0.0, updateSeconds = 0.0;
+        for (int f = 0; f < frames; ++f) {
+            int missing = population - particles.size();
+            auto start = benchClock::now();
+            particles.emit(positions.data(), missing, emitRng);
+            auto mid = benchClock::now();
+            particles.update(deltaTime);
+            auto end = benchClock::now();
+
+            emitted += missing;
+            emitSeconds += std::chrono::duration<double>(mid - start).count();
+            updateSeconds += std::chrono::duration<double>(end - mid).count();
+        }
+        emitTimes.push_back(emitSeconds);
+        updateTimes.push_back(updateSeconds);
+    }
+
+    // The interleaving copy render() does into the stream buffer
+    ParticlePool pool(population);
+    for (int i = 0; i < population; ++i)
+        pool.spawn(positions[i], glm::vec3(0.0f), 0.05f);
+    std::vector<Particle> packed(population);
+    auto start = benchClock::now();
+    for (int f = 0; f < frames; ++f)
+        pool.pack(packed.data());
+    double packNs = secondsSince(start) / frames * 1e9;
+
+    double emitNs = median(emitTimes) / frames * 1e9;
+    double updateNs = median(updateTimes) / frames * 1e9;
+    double frameNs = emitNs + updateNs;
+
+    printf("{\"bench\":\"particles\",\"particles\":%d,\"frames\":%d,\"emitted\":%lld,\"emit_ns\":%.1f,"
+           "\"update_ns\":%.1f,\"pack_ns\":%.1f,\"ns_per_frame\":%.1f,\"frames_per_sec\":%.0f,"
+           "\"ns_per_particle\":%.3f}\n",
+           population, frames, emitted / passes, emitNs, updateNs, packNs, frameNs, 1e9 / frameNs,
+           updateNs / population);
+}
+
+int main(int argc, char** argv) {
+    bool quick = false;
+    std::vector<const char*> files;
+    for (int i = 1; i < argc; ++i) {
+        if (strcmp(argv[i], "--quick") == 0)
+            quick = true;
+        else
+            files.push_back(argv[i]);
+    }
+    if (files.empty()) {
+        files.push_back("../assets/willow.ogg");
+        files.push_back("../assets/amaran.ogg");
+    }
+
+    const double seconds = quick ? 2.0 : 10.0;
+    std::vector<Signal> signals = { sineSweep(seconds), whiteNoise(seconds) };
+    for (const char* path : files) {
+        Signal s;
+        if (!decodeFile(path, s)) {
+            fprintf(stderr, "Skipping %s: cannot decode\n", path);
+            continue;
+        }
+        // Long tracks add time without adding information
+        s.samples.resize(std::min(s.samples.size(), size_t(seconds * s.sampleRate)));
+        signals.push_back(std::move(s));
+    }
+
+    const struct { BarScale scale; const char* name; } scales[] = {
+        { BarScale::Linear, "linear" }, { BarScale::Log, "log" }, { BarScale::Mel, "mel" }
+    };
+    const int barCounts[] = { 64, 256, 1024 };
+
+    for (const Signal& signal : signals) {
+        fprintf(stderr, "spectrum: %s\n", signal.name.c_str());
+        for (int fftSize = 256; fftSize <= 8192; fftSize *= 2) {
+            for (int numBars : barCounts) {
+                for (const auto& s : scales) {
+                    // Only the log scale is swept fully; the others differ only in the table
+                    if (s.scale != BarScale::Log && numBars != 256)
+                        continue;
+                    benchSpectrum(signal, fftSize, numBars, s.scale, s.name);
+                }
+            }
+        }
+    }
+
+    fprintf(stderr, "particles\n");
+    const int frames = quick ? 120 : 600;
+    for (int population : { 1024, 16384, 131072, 1 << 20 })
+        benchParticles(population, frames);
+
+    return 0;
+}
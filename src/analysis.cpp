@@ -0,0 +1,241 @@
+#include "analysis.h"
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <iostream>
+#include <thread>
+#include "audio.h"
+#include "capture.h"
+#include "profiler.h"
+#include "ring_buffer.h"
+#include "spectrum_feed.h"
+#include "spectrogram_index.h"
+#include "spectrum.h"
+
+// A frame reaches the screen about one refresh after it is analysed, so the
+// window is centred that far ahead of what is currently audible
+static const double displayLatency = 1.0 / 60.0;
+
+AnalysisConfig analysisConfig;
+
+static SpectrumAnalyzer* analyzer;
+static BarMapping barMapping;
+static std::vector<float> monoWindow;
+static std::vector<float> binHeights;
+static FeatureExtractor featureExtractor;
+
+static SpscRing<SpectrumFrame, 8> spectrumRing;
+static SpectrumFrame workFrame;
+
+static SpectrumFeedWriter feed;
+
+static std::thread analysisThread;
+static std::atomic<bool> analysisRunning{false};
+
+// Hands the finished workFrame to the renderer and to any feed readers
+static void publishFrame() {
+    spectrumRing.tryPush(workFrame);
+    if (!feed.isOpen())
+        return;
+
+    feed.publish([](FeedSlot& slot) {
+        const AudioFeatures& features = workFrame.features;
+        slot.position = workFrame.position;
+        slot.publishedAt = captureClock();
+        slot.capturedAt = workFrame.capturedAt;
+        std::copy(features.bands, features.bands + BandCount, slot.bands);
+        slot.onsetStrength = features.onsetStrength;
+        slot.onsetCount = features.onsetCount;
+        slot.tempo = features.tempo;
+        slot.tempoConfidence = features.tempoConfidence;
+        std::copy(workFrame.bars.begin(), workFrame.bars.end(), slot.bars());
+    });
+}
+
+// The live extractor and each track's index count onsets separately, and a
+// seek jumps an index's count, so the published count only takes on their
+// increase while the same source is followed without a jump. Switching
+// source, a track boundary or a seek carries it on unchanged instead of
+// looking like a burst of onsets.
+static unsigned publishedOnsets = 0;
+static const void* onsetSource = nullptr;
+static unsigned sourceOnsets = 0;
+static double lastHopTime = 0.0;
+// A larger step between hops is a seek
+static const double maxHopGap = 0.25;
+
+static void continueOnsetCount(const void* source, double time) {
+    unsigned count = workFrame.features.onsetCount;
+    double gap = time - lastHopTime;
+    if (source == onsetSource && count >= sourceOnsets && gap >= 0.0 && gap <= maxHopGap)
+        publishedOnsets += count - sourceOnsets;
+    onsetSource = source;
+    sourceOnsets = count;
+    lastHopTime = time;
+    workFrame.features.onsetCount = publishedOnsets;
+}
+
+// Analyses the window starting at the given frame and publishes it; time is
+// the stream time of file playback, or negative for live input
+static void analyseWindow(long long start, double capturedAt, double time) {
+    ProfileScope scope("analyse");
+    readMonoFrames(start, monoWindow.data(), analysisConfig.fftSize);
+    {
+        ProfileScope fftScope("fft");
+        analyzer->analyse(monoWindow.data(), binHeights.data());
+    }
+    featureExtractor.update(binHeights.data(), workFrame.features);
+    barMapping.apply(binHeights.data(), workFrame.bars.data());
+    workFrame.position = start;
+    workFrame.capturedAt = capturedAt;
+    // Live input never seeks or changes source; its count is already continuous
+    if (time >= 0.0)
+        continueOnsetCount(&featureExtractor, time);
+
+    publishFrame();
+}
+
+// The window centred on the given stream time: looked up in the track's
+// spectrogram index once it is ready, analysed from the audio until then
+static void analyseHop(double time) {
+    double trackTime;
+    if (const SpectrogramIndex* index = spectrogramIndexAt(time, trackTime)) {
+        ProfileScope scope("index lookup");
+        index->frameAt(trackTime, workFrame);
+        workFrame.position += std::llround((time - trackTime) * sampleRate);
+        continueOnsetCount(index, time);
+        publishFrame();
+        return;
+    }
+
+    long long center = (long long)(time * sampleRate);
+    analyseWindow(center - analysisConfig.fftSize / 2, 0.0, time);
+}
+
+// Runs one hop per analysisConfig.hopSize samples of audio, paced against a steady clock.
+// Where the window sits comes from the source's playback offset, so the pacing
+// only sets the update rate and never lets the bars drift from the music.
+// The same thread keeps the OpenAL stream queue topped up, which also makes
+// it the only writer of the decoded history the window is read from.
+static void analysisLoop() {
+    using clock = std::chrono::steady_clock;
+    const auto hopDuration = std::chrono::duration_cast<clock::duration>(
+        std::chrono::duration<double>(double(analysisConfig.hopSize) / sampleRate));
+
+    setProfilerThreadName("analysis");
+
+    auto deadline = clock::now();
+    while (analysisRunning.load(std::memory_order_relaxed)) {
+        {
+            ProfileScope scope("stream refill");
+            updateAudioStream();
+        }
+        analyseHop(playbackTime() + displayLatency);
+
+        deadline += hopDuration;
+        std::this_thread::sleep_until(deadline);
+    }
+}
+
+// Live input: there is nothing to sync to, so the newest fftSize frames are
+// analysed as soon as another hop of them has arrived. Polling at a fraction
+// of the hop keeps the wait between arrival and analysis short.
+static void captureLoop() {
+    const auto pollInterval = std::chrono::duration<double>(
+        std::max(0.25 * analysisConfig.hopSize / sampleRate, 0.0005));
+
+    setProfilerThreadName("capture");
+
+    long long analysedUpTo = historyEndFrame();
+    while (analysisRunning.load(std::memory_order_relaxed)) {
+        {
+            ProfileScope scope("capture poll");
+            pollCapture();
+        }
+
+        long long end = historyEndFrame();
+        if (end - analysedUpTo >= analysisConfig.hopSize) {
+            analyseWindow(end - analysisConfig.fftSize, lastCaptureTime(), -1.0);
+            analysedUpTo = end;
+        }
+
+        std::this_thread::sleep_for(pollInterval);
+    }
+}
+
+bool validateAnalysisConfig(const AnalysisConfig& config) {
+    // The decoded history in audio.cpp covers 32768 frames, which bounds the window
+    if (config.fftSize < 64 || config.fftSize > 8192 || (config.fftSize & (config.fftSize - 1))) {
+        std::cerr << "FFT size must be a power of two between 64 and 8192\n";
+        return false;
+    }
+    if (config.hopSize < 1 || config.hopSize > config.fftSize) {
+        std::cerr << "Hop size must be between 1 and the FFT size\n";
+        return false;
+    }
+    if (config.numBars < 1 || config.numBars > 4096) {
+        std::cerr << "Bar count must be between 1 and 4096\n";
+        return false;
+    }
+    return true;
+}
+
+// step is the time between analyses, which the onset and tempo tracking count in
+static bool setupAnalyzer(double step) {
+    if (analyzer || sampleRate <= 0)
+        return false;
+
+    const AnalysisConfig& config = analysisConfig;
+    analyzer = new SpectrumAnalyzer(config.fftSize);
+    barMapping.build(config.fftSize, sampleRate, config.numBars, config.barScale);
+    monoWindow.assign(config.fftSize, 0.0f);
+    binHeights.assign(config.fftSize / 2, 0.0f);
+    featureExtractor.configure(config.fftSize, sampleRate, step);
+    workFrame.bars.assign(config.numBars, 0.0f);
+    return true;
+}
+
+void startAnalysis() {
+    if (analysisRunning || !setupAnalyzer(double(analysisConfig.hopSize) / sampleRate))
+        return;
+
+    analysisRunning = true;
+    analysisThread = std::thread(captureActive() ? captureLoop : analysisLoop);
+}
+
+void stopAnalysis() {
+    analysisRunning = false;
+    if (analysisThread.joinable())
+        analysisThread.join();
+
+    delete analyzer;
+    analyzer = nullptr;
+}
+
+void startOfflineAnalysis(double frameStep) {
+    setupAnalyzer(frameStep);
+}
+
+void analyseAt(double time) {
+    if (analyzer)
+        analyseHop(time);
+}
+
+bool startSpectrumFeed(const char* name) {
+    const AnalysisConfig& config = analysisConfig;
+    if (!feed.open(name, config.numBars, sampleRate, config.fftSize, config.hopSize)) {
+        std::cerr << "Cannot create shared memory feed " << name << "\n";
+        return false;
+    }
+    std::clog << "Publishing analysis frames to shared memory " << name << "\n";
+    return true;
+}
+
+void stopSpectrumFeed() {
+    feed.close();
+}
+
+bool latestSpectrumFrame(SpectrumFrame& out) {
+    return spectrumRing.popLatest(out);
+}
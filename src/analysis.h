@@ -0,0 +1,50 @@
+#ifndef ANALYSIS_H
+#define ANALYSIS_H
+
+#include <vector>
+#include "audio_features.h"
+#include "spectrum.h"
+
+// Analysis resolution, chosen at startup (see the command line in main.cpp)
+struct AnalysisConfig {
+    int fftSize = 2048;
+    int hopSize = 512;
+    int numBars = 256;
+    BarScale barScale = BarScale::Log;
+};
+
+extern AnalysisConfig analysisConfig;
+
+// One analysis hop worth of output, produced on the analysis thread
+struct SpectrumFrame {
+    std::vector<float> bars;  // analysisConfig.numBars heights
+    long long position;       // stream frame the window started at
+    double capturedAt = 0.0;  // live input: when its newest samples arrived
+    AudioFeatures features;
+};
+
+// Checks the config and reports what is wrong with it on stderr
+bool validateAnalysisConfig(const AnalysisConfig& config);
+
+// Follows file playback, or live input once startCapture() has succeeded.
+// File playback reads from the spectrogram index when there is one (see
+// spectrogram_index.h); live input is always analysed as it arrives.
+void startAnalysis();
+void stopAnalysis();
+
+// Offline rendering: no thread, the caller asks for each window explicitly
+// (the audio must already be decoded past it) and it lands in the same ring.
+// frameStep is the time between analyseAt() calls, for the features.
+void startOfflineAnalysis(double frameStep);
+void analyseAt(double time);
+
+// Also publishes every frame to other processes through a POSIX shared
+// memory ring (see spectrum_feed.h). Call once the sample rate is known and
+// before the analysis starts.
+bool startSpectrumFeed(const char* name);
+void stopSpectrumFeed();
+
+// Non-blocking: copies the newest frame produced since the last call
+bool latestSpectrumFrame(SpectrumFrame& out);
+
+#endif
@@ -1,22 +1,86 @@
 #include "audio.h"
+#include <AL/alext.h>
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <condition_variable>
 #include <iostream>
-#define STB_VORBIS_IMPLEMENTATION
-#include "../external/stb/stb_vorbis.c"
-#include "cleanup.h" 
+#include <mutex>
+#include <thread>
+#include "analysis.h"
+#include "decoder.h"
+#include "cleanup.h"
+#include "pcm_file.h"
+#include "spectrogram_index.h"
 
 ALCdevice* device;
 ALCcontext* context;
 ALuint source;
-ALuint buffer;
+ALuint streamBuffers[streamBufferCount];
 
-short* audioData = nullptr;
-int audioDataSize = 0;
 int sampleRate = 0;
-int playbackIndex = 0;
 int channels = 0;
 
+// Filled in when the driver exposes AL_SOFT_source_latency
+static LPALGETSOURCEDVSOFT alGetSourcedvSOFT;
+
+// One open playlist entry. Exactly one of mapped and stream is open: PCM is
+// streamed and analysed straight out of the mapping, Ogg Vorbis is decoded
+// chunk by chunk.
+struct Track {
+    std::string path;
+    MappedPcm mapped;
+    VorbisStream stream;
+    long long lengthFrames = 0;
+    // Stream frame the track's first frame was queued at
+    long long startFrame = 0;
+    // Published by the worker once loaded or built
+    std::atomic<const SpectrogramIndex*> index{nullptr};
+
+    ~Track() { delete index.load(); }
+};
+
+// The track being heard and the track chunks are read from. They only
+// differ from the moment the queue runs on into the next track until the
+// last buffer of the previous one has played. Together with the preloaded
+// next track, no more than two tracks are open for long.
+static Track* heard;
+static Track* queued;
+static std::atomic<Track*> preloaded{nullptr};
+
+static std::vector<std::string> playlist;
+static size_t nextEntry = 0;
+static bool useIndex = false;
+
+// Works ahead of playback: writes the .pcm cache of an .ogg, builds the
+// spectrogram index, and opens and prepares the next track
+static std::thread worker;
+static std::atomic<bool> workerAbort{false};
+static std::mutex workerMutex;
+static std::condition_variable workerWake;
+static bool preloadWanted = false;
+
+static short chunk[streamChunkFrames * 2];
+
+// Stream buffers not in the source's queue
+static ALuint freeBuffers[streamBufferCount];
+static int freeBufferCount = 0;
+
+// Frames are counted on one timeline across all tracks, the stream. Every
+// decoded chunk is also downmixed into this ring, indexed by stream frame,
+// so the analysis reads the same samples that were queued.
+const int historyFrames = 1 << 15;
+static float history[historyFrames];
+static long long decodedFrames = 0;
+
+// Frames in buffers that have finished playing and been unqueued
+static long long unqueuedFrames = 0;
+
+// Seeks asked for since the last updateAudioStream(), in milliseconds
+static std::atomic<long long> pendingSeek{0};
+
 void initOpenAL() {
-    device = alcOpenDevice(nullptr); 
+    device = alcOpenDevice(nullptr);
     if (!device) {
         std::cerr << "Failed to open OpenAL device\n";
         return;
@@ -26,42 +90,374 @@ void initOpenAL() {
     alcMakeContextCurrent(context);
 
     alGenSources(1, &source);
-    alGenBuffers(1, &buffer);
+    alGenBuffers(streamBufferCount, streamBuffers);
+    std::copy(streamBuffers, streamBuffers + streamBufferCount, freeBuffers);
+    freeBufferCount = streamBufferCount;
+
+    if (alIsExtensionPresent("AL_SOFT_source_latency"))
+        alGetSourcedvSOFT = (LPALGETSOURCEDVSOFT)alGetProcAddress("alGetSourcedvSOFT");
+}
+
+// All tracks share one OpenAL source, so they must share its format; the
+// first track sets it
+static Track* openTrack(const std::string& path) {
+    Track* track = new Track;
+    track->path = path;
+
+    const char* filename = path.c_str();
+    bool isMapped = isPcmFile(filename) ? track->mapped.open(filename) : track->mapped.openCache(filename);
+    if (!isMapped && !track->stream.open(filename)) {
+        std::cerr << "Cannot play " << path << "\n";
+        delete track;
+        return nullptr;
+    }
+
+    int trackChannels = isMapped ? track->mapped.channels : track->stream.channels;
+    int trackRate = isMapped ? track->mapped.sampleRate : track->stream.sampleRate;
+    track->lengthFrames = isMapped ? track->mapped.lengthFrames : track->stream.lengthFrames;
+
+    if (channels == 0) {
+        channels = trackChannels;
+        sampleRate = trackRate;
+    } else if (trackChannels != channels || trackRate != sampleRate) {
+        std::cerr << "Skipping " << path << ": " << trackChannels << " channels at " << trackRate
+                  << " Hz, the playlist plays " << channels << " at " << sampleRate << " Hz\n";
+        delete track;
+        return nullptr;
+    }
+
+    // stderr, so stdout stays clean when offline frames are streamed there
+    std::clog << "Audio " << (isMapped ? "mapped" : "opened") << ": " << path << ", " << track->lengthFrames
+              << " frames, " << channels << " channels, " << sampleRate << " Hz\n";
+    return track;
 }
 
-void loadAudio(const char* filename) {
-    int channels;
-    audioDataSize = stb_vorbis_decode_filename(filename, &channels, &sampleRate, &audioData);
-    if (!audioData) {
+// An .ogg is decoded into its cache once. A track that has not started
+// yet then plays from the mapping.
+static void cacheTrack(Track* track, bool started) {
+    if (track->stream.isOpen() && writePcmCache(track->path, workerAbort) && !started) {
+        if (track->mapped.openCache(track->path.c_str()))
+            track->stream.close();
+    }
+}
+
+// Published through the atomic, so the analysis picks it up whenever it is done
+static void indexTrack(Track* track) {
+    if (useIndex && !workerAbort)
+        track->index = loadSpectrogramIndex(track->path.c_str(), analysisConfig, workerAbort);
+}
+
+// Prepares the track that is playing, then keeps one track ready ahead of
+// it. The next one is only opened after the previous track has played out,
+// and handed over before its index is built, which it does not need to play.
+static void workerLoop(Track* first) {
+    cacheTrack(first, true);
+    indexTrack(first);
+
+    while (!workerAbort) {
+        {
+            std::unique_lock<std::mutex> lock(workerMutex);
+            workerWake.wait(lock, [] { return preloadWanted || workerAbort; });
+            preloadWanted = false;
+        }
+
+        // Unplayable entries are skipped; a list without any ends after this track
+        Track* next = nullptr;
+        for (size_t tries = 0; !next && tries < playlist.size() && !workerAbort; ++tries) {
+            next = openTrack(playlist[nextEntry]);
+            nextEntry = (nextEntry + 1) % playlist.size();
+        }
+        if (!next)
+            return;
+
+        cacheTrack(next, false);
+        preloaded = next;
+        // Not freed until a later track has been handed over, which waits for this
+        indexTrack(next);
+    }
+}
+
+static void stopWorker() {
+    {
+        std::lock_guard<std::mutex> lock(workerMutex);
+        workerAbort = true;
+    }
+    workerWake.notify_one();
+    if (worker.joinable())
+        worker.join();
+    workerAbort = false;
+}
+
+void loadAudio(const std::vector<std::string>& paths, bool buildIndex, bool preload) {
+    closeAudio();
+
+    playlist = paths;
+    useIndex = buildIndex;
+    heard = queued = openTrack(playlist[0]);
+    if (!heard) {
         std::cerr << "Audio load failed.\n";
         exit(-1);
     }
-    std::cout << "Audio loaded: " << audioDataSize << " samples\n" << channels << " channels, " << sampleRate << " Hz\n";
+    nextEntry = 1 % playlist.size();
+
+    decodedFrames = 0;
+    unqueuedFrames = 0;
+
+    if (preload) {
+        preloadWanted = true;
+        worker = std::thread(workerLoop, heard);
+    } else {
+        cacheTrack(heard, false);
+        indexTrack(heard);
+    }
+}
+
+// Downmixes interleaved frames onto the end of the analysis history
+static void appendHistory(const short* samples, int frames, int sampleChannels) {
+    for (int i = 0; i < frames; ++i) {
+        float sum = 0.0f;
+        for (int c = 0; c < sampleChannels; ++c)
+            sum += samples[i * sampleChannels + c];
+        history[(decodedFrames + i) & (historyFrames - 1)] = sum / sampleChannels;
+    }
+    decodedFrames += frames;
+}
+
+// The next chunk of a track: a pointer into the mapping, or decoded into
+// `chunk` and copied to the analysis history. nullptr at the track's end.
+static const short* readChunk(Track* track, int& frames) {
+    if (track->mapped.isOpen()) {
+        long long position = decodedFrames - track->startFrame;
+        frames = (int)std::min<long long>(streamChunkFrames, track->lengthFrames - position);
+        if (frames <= 0)
+            return nullptr;
+        decodedFrames += frames;
+        return track->mapped.frames() + position * channels;
+    }
+
+    frames = track->stream.read(chunk, streamChunkFrames);
+    if (frames <= 0)
+        return nullptr;
+    appendHistory(chunk, frames, channels);
+    return chunk;
+}
+
+// The next chunk of interleaved frames. At the end of a track the next one
+// carries straight on in the same queue, so the handover has no gap; if it
+// is not ready yet, this is retried on the next update.
+static const short* nextChunk(int& frames) {
+    if (!queued)
+        return nullptr;
+
+    const short* data = readChunk(queued, frames);
+    if (data)
+        return data;
+
+    Track* next = preloaded.exchange(nullptr);
+    if (!next)
+        return nullptr;
+    next->startFrame = decodedFrames;
+    queued = next;
+    return readChunk(queued, frames);
+}
+
+// Fills an AL buffer with the next chunk
+static bool fillBuffer(ALuint alBuffer, ALenum format) {
+    int frames;
+    const short* data = nextChunk(frames);
+    if (!data)
+        return false;
+
+    alBufferData(alBuffer, format, data, frames * channels * sizeof(short), sampleRate);
+    return true;
+}
+
+bool decodeAudioUntil(long long frame) {
+    int frames;
+    while (decodedFrames < frame && nextChunk(frames)) {
+    }
+    return decodedFrames >= frame;
+}
+
+long long audioLengthFrames() {
+    return heard ? heard->lengthFrames : 0;
+}
+
+void closeAudio() {
+    stopWorker();
+    if (queued != heard)
+        delete queued;
+    delete heard;
+    delete preloaded.exchange(nullptr);
+    heard = queued = nullptr;
+    playlist.clear();
+}
+
+void appendCapturedFrames(const short* samples, int frames) {
+    appendHistory(samples, frames, 1);
+}
+
+long long historyEndFrame() {
+    return decodedFrames;
+}
+
+static ALenum streamFormat() {
+    return channels == 1 ? AL_FORMAT_MONO16 : AL_FORMAT_STEREO16;
+}
 
-    ::channels = channels;
-    ::sampleRate = sampleRate;
+// Fills and queues the free buffers, as far as there is audio to fill them
+static void queueFreeBuffers() {
+    while (freeBufferCount > 0 && fillBuffer(freeBuffers[freeBufferCount - 1], streamFormat())) {
+        --freeBufferCount;
+        alSourceQueueBuffers(source, 1, &freeBuffers[freeBufferCount]);
+    }
 }
 
 void playAudio() {
-    if (channels == 0 || audioData == nullptr) {
+    if (channels == 0 || !heard) {
         std::cerr << "Invalid audio data.\n";
         return;
     }
 
-    ALenum format;
-    if (channels == 1) {
-        format = AL_FORMAT_MONO16;
-    } else if (channels == 2) {
-        format = AL_FORMAT_STEREO16;
-    } else {
-        std::cerr << "Unsupported channel count: " << channels << std::endl;
+    // Prime the queue; playback starts after a few chunks, not the whole file
+    queueFreeBuffers();
+    alSourcePlay(source);
+}
+
+void seekAudio(double seconds) {
+    pendingSeek += std::llround(seconds * 1000.0);
+}
+
+// Restarts the stream at the new position, within the track being heard. A
+// handover in progress is undone and the next track goes back to waiting.
+// The history is cleared so the analysis never mixes audio from before the
+// jump into its window.
+static void applySeek(double seconds) {
+    if (!heard)
         return;
+
+    double trackTime = playbackTime() - double(heard->startFrame) / sampleRate;
+    long long last = std::max(heard->lengthFrames - 1, 0ll);
+    long long target = std::clamp(std::llround((trackTime + seconds) * sampleRate), 0ll, last);
+    if (heard->stream.isOpen() && !heard->stream.seek(target))
+        return;
+
+    if (queued != heard) {
+        if (queued->stream.isOpen())
+            queued->stream.rewind();
+        preloaded = queued;
+        queued = heard;
     }
 
-    alBufferData(buffer, format, audioData, audioDataSize * sizeof(short), sampleRate);
-    alSourcei(source, AL_BUFFER, buffer);
+    alSourceStop(source);
+    alSourcei(source, AL_BUFFER, 0);
+    std::copy(streamBuffers, streamBuffers + streamBufferCount, freeBuffers);
+    freeBufferCount = streamBufferCount;
+
+    // The stream keeps counting on; the track is moved so target comes next
+    std::fill(history, history + historyFrames, 0.0f);
+    heard->startFrame = decodedFrames - target;
+    unqueuedFrames = decodedFrames;
+
+    queueFreeBuffers();
     alSourcePlay(source);
 }
 
+void updateAudioStream() {
+    if (!source)
+        return;
+
+    long long seek = pendingSeek.exchange(0);
+    if (seek != 0)
+        applySeek(seek / 1000.0);
+
+    ALint processed = 0;
+    alGetSourcei(source, AL_BUFFERS_PROCESSED, &processed);
+    while (processed-- > 0) {
+        ALuint alBuffer;
+        alSourceUnqueueBuffers(source, 1, &alBuffer);
+
+        ALint size = 0;
+        alGetBufferi(alBuffer, AL_SIZE, &size);
+        unqueuedFrames += size / (channels * (ALint)sizeof(short));
+        freeBuffers[freeBufferCount++] = alBuffer;
+    }
+
+    // Once every buffer of the previous track has played, it is closed and
+    // the worker starts on the one after
+    if (heard != queued && unqueuedFrames >= queued->startFrame) {
+        delete heard;
+        heard = queued;
+        {
+            std::lock_guard<std::mutex> lock(workerMutex);
+            preloadWanted = true;
+        }
+        workerWake.notify_one();
+    }
+
+    queueFreeBuffers();
+
+    // The source stops by itself if the queue ran dry; pick up where it left off
+    ALint state, queuedBuffers;
+    alGetSourcei(source, AL_SOURCE_STATE, &state);
+    alGetSourcei(source, AL_BUFFERS_QUEUED, &queuedBuffers);
+    if (state == AL_STOPPED && queuedBuffers > 0)
+        alSourcePlay(source);
+}
+
+double playbackTime() {
+    if (!source || sampleRate <= 0)
+        return 0.0;
 
+    // Source offsets are relative to the head of the queue
+    double unqueuedTime = double(unqueuedFrames) / sampleRate;
 
+    // Offset minus the device latency is what is actually reaching the speakers
+    if (alGetSourcedvSOFT) {
+        ALdouble offsetLatency[2];
+        alGetSourcedvSOFT(source, AL_SEC_OFFSET_LATENCY_SOFT, offsetLatency);
+        return unqueuedTime + offsetLatency[0] - offsetLatency[1];
+    }
+
+    ALint offset = 0;
+    alGetSourcei(source, AL_SAMPLE_OFFSET, &offset);
+    return unqueuedTime + double(offset) / sampleRate;
+}
+
+// The track a stream frame belongs to
+static const Track* trackAt(long long frame) {
+    return queued != heard && frame >= queued->startFrame ? queued : heard;
+}
+
+const SpectrogramIndex* spectrogramIndexAt(double time, double& trackTime) {
+    const Track* track = trackAt((long long)(time * sampleRate));
+    if (!track)
+        return nullptr;
+    trackTime = time - double(track->startFrame) / sampleRate;
+    return track->index.load(std::memory_order_acquire);
+}
+
+void readMonoFrames(long long start, float* dst, int count) {
+    long long oldest = decodedFrames - historyFrames;
+    for (int i = 0; i < count; ++i) {
+        long long frame = start + i;
+
+        // Mapped audio is all there, read in place at any position
+        const Track* track = trackAt(frame);
+        if (track && track->mapped.isOpen()) {
+            long long position = frame - track->startFrame;
+            float sum = 0.0f;
+            if (position >= 0 && position < track->lengthFrames) {
+                const short* pcm = track->mapped.frames() + position * channels;
+                for (int c = 0; c < channels; ++c)
+                    sum += pcm[c];
+            }
+            dst[i] = sum / channels;
+            continue;
+        }
+
+        dst[i] = (frame < 0 || frame < oldest || frame >= decodedFrames)
+                     ? 0.0f
+                     : history[frame & (historyFrames - 1)];
+    }
+}
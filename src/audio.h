@@ -3,21 +3,63 @@
 
 #include <AL/al.h>
 #include <AL/alc.h>
+#include <string>
+#include <vector>
+
+class SpectrogramIndex;
 
 extern ALCdevice* device;
 extern ALCcontext* context;
+// Decoded audio is streamed through a small ring of queued buffers
+const int streamBufferCount = 4;
+const int streamChunkFrames = 4096;
+
 extern ALuint source;
-extern ALuint buffer;
-extern short* audioData;
-extern int audioDataSize;
+extern ALuint streamBuffers[streamBufferCount];
 extern int sampleRate;
-extern int playbackIndex;
 extern int channels;
 
 void initOpenAL();
-void loadAudio(const char* filename);
+// Opens the first track of the playlist. .wav and .pcm files, and .ogg
+// files with an up-to-date .pcm cache next to them, are memory-mapped;
+// other .ogg files are decoded as they play while the cache is written for
+// next time. With preload, a worker thread opens and prepares each following
+// track (cache, index) while the current one plays, playback runs on
+// into it without a gap, and the list repeats. Without, as offline, only the
+// first track plays and its index is built before this returns.
+void loadAudio(const std::vector<std::string>& playlist, bool buildIndex, bool preload);
+void closeAudio();
 void playAudio();
 void cleanup();
 
+// Refills buffers the source has finished with; call at least once per chunk.
+// Also carries out seeks.
+void updateAudioStream();
+
+// Moves playback by the given seconds, clamped to the track. Safe from any
+// thread; takes effect on the next updateAudioStream().
+void seekAudio(double seconds);
+
+// Offline use without an AL device: decodes into the history only, so frames
+// up to `frame` can be read; false once the track ends before that
+bool decodeAudioUntil(long long frame);
+// Of the track being heard
+long long audioLengthFrames();
+
+// Live input (capture.cpp): appends mono frames to the same history the
+// file decoder writes, from the analysis thread only
+void appendCapturedFrames(const short* samples, int frames);
+// One past the newest frame in the history
+long long historyEndFrame();
+// Seconds of the stream heard so far, compensated for output latency. The
+// stream is every track played back to back, counted in frames from 0.
+double playbackTime();
+// The index of the track playing at the given stream time, and the time
+// within that track; nullptr until the index is ready. Analysis thread only.
+const SpectrogramIndex* spectrogramIndexAt(double time, double& trackTime);
+// Mono copy of stream frames [start, start + count) from recently decoded
+// audio, zero for frames not yet decoded or already dropped from the history
+void readMonoFrames(long long start, float* dst, int count);
+
 #endif // AUDIO_H
 
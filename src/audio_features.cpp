@@ -0,0 +1,146 @@
+#include "audio_features.h"
+#include <algorithm>
+#include <cmath>
+#include "spectrum.h"
+
+static const float bandFrequencies[BandCount + 1] = { 20.0f, 60.0f, 250.0f, 2000.0f, 16000.0f };
+
+// Adaptive threshold: flux must exceed the recent mean by this factor plus a
+// small floor, and onsets closer together than minOnsetGap are merged
+const double fluxWindowSeconds = 0.5;
+const float thresholdScale = 1.5f;
+const float thresholdFloor = 0.05f;
+const double minOnsetGap = 0.05;
+
+const double attackSeconds = 0.01;
+const double releaseSeconds = 0.25;
+
+// Tempo search range and how long the autocorrelation remembers
+const double minTempo = 60.0;
+const double maxTempo = 180.0;
+const double tempoMemorySeconds = 8.0;
+
+// Periodic onsets correlate at multiples of the beat too; weighting lags by a
+// log-Gaussian around a typical tempo picks the beat over its octaves
+const double preferredTempo = 120.0;
+const double tempoSpreadOctaves = 0.7;
+
+void FeatureExtractor::configure(int fftSize, int sampleRate, double updateStep) {
+    bins = fftSize / 2;
+    step = updateStep;
+
+    const float binHz = float(sampleRate) / fftSize;
+    for (int i = 0; i <= BandCount; ++i) {
+        int edge = std::min(std::max(int(std::lround(bandFrequencies[i] / binHz)), 1), bins);
+        // Tiny FFTs collapse the low bands; keep every band at least one bin wide
+        if (i > 0)
+            edge = std::max(edge, std::min(bandEdges[i - 1] + 1, bins));
+        bandEdges[i] = edge;
+    }
+    previous.assign(bins, 0.0f);
+
+    fluxHistory.assign(std::max(8, int(fluxWindowSeconds / step)), 0.0f);
+    fluxCursor = fluxCount = 0;
+    fluxSum = 0.0f;
+    sinceOnset = 0;
+    onsets = 0;
+    lastOnsetStrength = 0.0f;
+
+    std::fill(levels, levels + BandCount, 0.0f);
+    attack = float(1.0 - std::exp(-step / attackSeconds));
+    release = float(1.0 - std::exp(-step / releaseSeconds));
+
+    minLag = std::max(2, int(60.0 / maxTempo / step));
+    maxLag = std::max(minLag + 2, int(std::ceil(60.0 / minTempo / step)));
+    strength.assign(maxLag + 1, 0.0f);
+    correlation.assign(maxLag + 2, 0.0f);
+    lagWeights.assign(maxLag + 1, 0.0f);
+    for (int lag = minLag; lag <= maxLag; ++lag) {
+        double octaves = std::log2(60.0 / (lag * step) / preferredTempo) / tempoSpreadOctaves;
+        lagWeights[lag] = float(std::exp(-0.5 * octaves * octaves));
+    }
+    strengthCursor = 0;
+    updates = 0;
+    correlationDecay = float(std::exp(-step / tempoMemorySeconds));
+    smoothedTempo = 0.0f;
+}
+
+void FeatureExtractor::update(const float* binHeights, AudioFeatures& out) {
+    // One pass over the bins for both the flux and the band sums
+    float flux = 0.0f;
+    for (int b = 0; b < BandCount; ++b) {
+        float sum = 0.0f;
+        for (int k = bandEdges[b]; k < bandEdges[b + 1]; ++k) {
+            float h = binHeights[k];
+            float rise = h - previous[k];
+            flux += rise > 0.0f ? rise : 0.0f;
+            previous[k] = h;
+            sum += h;
+        }
+
+        int count = bandEdges[b + 1] - bandEdges[b];
+        float target = count > 0 ? sum / (count * SpectrumAnalyzer::maxBarHeight) : 0.0f;
+        float rate = target > levels[b] ? attack : release;
+        levels[b] += rate * (target - levels[b]);
+        out.bands[b] = levels[b];
+    }
+    flux /= std::max(bandEdges[BandCount] - bandEdges[0], 1);
+
+    // Onsets against the mean of the last fluxWindowSeconds of flux
+    float mean = fluxCount > 0 ? fluxSum / fluxCount : 0.0f;
+    float threshold = mean * thresholdScale + thresholdFloor;
+    ++sinceOnset;
+    out.onset = fluxCount == (int)fluxHistory.size() && flux > threshold && sinceOnset * step >= minOnsetGap;
+    if (out.onset) {
+        sinceOnset = 0;
+        ++onsets;
+        lastOnsetStrength = std::min((flux - threshold) / (mean + thresholdFloor), 4.0f) * 0.25f;
+    }
+    out.onsetCount = onsets;
+    out.onsetStrength = lastOnsetStrength;
+
+    fluxSum += flux - fluxHistory[fluxCursor];
+    fluxHistory[fluxCursor] = flux;
+    fluxCursor = (fluxCursor + 1) % (int)fluxHistory.size();
+    fluxCount = std::min(fluxCount + 1, (int)fluxHistory.size());
+
+    // Tempo: decaying autocorrelation of the flux above its mean
+    const int ringSize = (int)strength.size();
+    float s = std::max(flux - mean, 0.0f);
+    strength[strengthCursor] = s;
+    for (int lag = minLag; lag <= maxLag && lag <= updates; ++lag) {
+        float past = strength[(strengthCursor - lag + ringSize) % ringSize];
+        correlation[lag] = correlation[lag] * correlationDecay + s * past;
+    }
+    strengthCursor = (strengthCursor + 1) % ringSize;
+    ++updates;
+
+    if (updates > 2 * maxLag) {
+        int best = minLag;
+        float total = 0.0f;
+        for (int lag = minLag; lag <= maxLag; ++lag) {
+            total += correlation[lag];
+            if (correlation[lag] * lagWeights[lag] > correlation[best] * lagWeights[best])
+                best = lag;
+        }
+        float peak = correlation[best];
+        float average = total / (maxLag - minLag + 1);
+        float confidence = peak > 0.0f ? (peak - average) / peak : 0.0f;
+
+        // Parabolic fit around the peak for a lag between whole updates
+        float lag = float(best);
+        if (best > minLag && best < maxLag) {
+            float a = correlation[best - 1], c = correlation[best + 1];
+            float denominator = a - 2.0f * peak + c;
+            if (denominator < 0.0f)
+                lag += 0.5f * (a - c) / denominator;
+        }
+
+        if (confidence > 0.1f) {
+            float tempo = float(60.0 / (lag * step));
+            smoothedTempo = smoothedTempo > 0.0f ? smoothedTempo + 0.1f * (tempo - smoothedTempo) : tempo;
+        }
+        out.tempoConfidence = confidence;
+    }
+    out.tempo = smoothedTempo;
+}
@@ -0,0 +1,67 @@
+#ifndef AUDIO_FEATURES_H
+#define AUDIO_FEATURES_H
+
+#include <vector>
+
+enum Band { SubBand, BassBand, MidBand, HighBand, BandCount };
+
+// What the visuals react to, refreshed on every analysis hop
+struct AudioFeatures {
+    bool onset = false;             // an onset in this hop
+    unsigned onsetCount = 0;        // onsets so far; a reader that skips hops compares counts
+    float onsetStrength = 0.0f;     // of the latest onset, 0..1
+    float bands[BandCount] = {};    // smoothed band levels, 0..1
+    float tempo = 0.0f;             // beats per minute, 0 until there is enough history
+    float tempoConfidence = 0.0f;   // 0..1
+};
+
+// Incremental feature extraction on the per-bin heights the SpectrumAnalyzer
+// produces. Each update is a single pass over the bins (spectral flux and
+// band sums together) plus O(lags) for the tempo, and nothing is allocated
+// after configure().
+//
+// Onsets: positive spectral flux above 1.5 times the mean of the last half
+// second of flux plus a small floor, at most one per 50 ms. Bands: mean
+// height over sub (20-60 Hz), bass (60-250 Hz), mid (250 Hz-2 kHz) and high
+// (2-16 kHz), smoothed with a fast attack and slow release. Tempo: the flux
+// signal is autocorrelated with exponentially decaying accumulators over lags
+// covering 60-180 BPM, with a preference for tempos near 120 BPM to settle
+// octave ambiguity.
+class FeatureExtractor {
+public:
+    // step is the time between updates
+    void configure(int fftSize, int sampleRate, double step);
+    void update(const float* binHeights, AudioFeatures& out);
+
+private:
+    int bins = 0;
+    double step = 0.0;
+    int bandEdges[BandCount + 1] = {};
+    std::vector<float> previous;
+
+    // Recent flux values for the adaptive threshold
+    std::vector<float> fluxHistory;
+    int fluxCursor = 0;
+    int fluxCount = 0;
+    float fluxSum = 0.0f;
+    int sinceOnset = 0;
+    unsigned onsets = 0;
+    float lastOnsetStrength = 0.0f;
+
+    float levels[BandCount] = {};
+    float attack = 0.0f;
+    float release = 0.0f;
+
+    // Onset strength ring and autocorrelation per lag, in updates
+    std::vector<float> strength;
+    int strengthCursor = 0;
+    int updates = 0;
+    int minLag = 0;
+    int maxLag = 0;
+    std::vector<float> correlation;
+    std::vector<float> lagWeights;
+    float correlationDecay = 0.0f;
+    float smoothedTempo = 0.0f;
+};
+
+#endif
@@ -0,0 +1,216 @@
+#include "bloom.h"
+#include <algorithm>
+#include <glm/glm.hpp>
+#include "shaders.h"
+
+const int maxLevels = 8;
+// Levels below the first stop halving once a side would be smaller than this
+const int minLevelSize = 4;
+
+static BloomConfig config;
+static bool active = false;
+
+// Full-screen triangles need no vertex data, but core GL wants a VAO bound
+static GLuint emptyVAO;
+
+// Level i is allocated at half the size of level i - 1, starting at half the
+// scene texture; like the scene, a level only uses its bottom-left part
+static GLuint levelTextures[maxLevels];
+static GLuint levelFramebuffers[maxLevels];
+static int levelTextureWidth[maxLevels], levelTextureHeight[maxLevels];
+static int allocatedLevels = 0;
+static int allocatedWidth, allocatedHeight;
+
+// What the last renderBloom() left in level 0, for the composite
+static int levelsUsed = 0;
+static glm::vec2 bloomScale, bloomTexel;
+
+// Uniform handles, resolved in initBloom()
+static int downsampleSourceUniform, downsampleScaleUniform, downsampleTexelUniform;
+static int downsampleThresholdUniform, downsampleKneeUniform;
+static int upsampleSourceUniform, upsampleScaleUniform, upsampleTexelUniform;
+static int compositeSceneUniform, compositeBloomUniform, compositeSceneScaleUniform, compositeSceneTexelUniform;
+static int compositeBloomScaleUniform, compositeBloomTexelUniform, compositeStrengthUniform;
+
+static glm::vec2 sceneTexel;
+
+void initBloom(const BloomConfig& bloomConfig) {
+    config = bloomConfig;
+    config.levels = std::clamp(config.levels, 1, maxLevels);
+    config.strength = std::max(config.strength, 0.0f);
+
+    glGenVertexArrays(1, &emptyVAO);
+
+    downsampleSourceUniform = bloomDownsampleProgram.uniform("source");
+    downsampleScaleUniform = bloomDownsampleProgram.uniform("sourceScale");
+    downsampleTexelUniform = bloomDownsampleProgram.uniform("texel");
+    downsampleThresholdUniform = bloomDownsampleProgram.uniform("threshold");
+    downsampleKneeUniform = bloomDownsampleProgram.uniform("knee");
+    upsampleSourceUniform = bloomUpsampleProgram.uniform("source");
+    upsampleScaleUniform = bloomUpsampleProgram.uniform("sourceScale");
+    upsampleTexelUniform = bloomUpsampleProgram.uniform("texel");
+    compositeSceneUniform = compositeProgram.uniform("scene");
+    compositeBloomUniform = compositeProgram.uniform("bloom");
+    compositeSceneScaleUniform = compositeProgram.uniform("sceneScale");
+    compositeSceneTexelUniform = compositeProgram.uniform("sceneTexel");
+    compositeBloomScaleUniform = compositeProgram.uniform("bloomScale");
+    compositeBloomTexelUniform = compositeProgram.uniform("bloomTexel");
+    compositeStrengthUniform = compositeProgram.uniform("strength");
+
+    // Sampler units never change
+    bloomDownsampleProgram.use();
+    bloomDownsampleProgram.set(downsampleSourceUniform, 0);
+    bloomUpsampleProgram.use();
+    bloomUpsampleProgram.set(upsampleSourceUniform, 0);
+    compositeProgram.use();
+    compositeProgram.set(compositeSceneUniform, 0);
+    compositeProgram.set(compositeBloomUniform, 1);
+    glUseProgram(0);
+
+    active = true;
+}
+
+static void releaseLevels() {
+    if (allocatedLevels == 0)
+        return;
+    glDeleteFramebuffers(allocatedLevels, levelFramebuffers);
+    glDeleteTextures(allocatedLevels, levelTextures);
+    allocatedLevels = 0;
+    allocatedWidth = allocatedHeight = 0;
+}
+
+void destroyBloom() {
+    if (!active)
+        return;
+    releaseLevels();
+    glDeleteVertexArrays(1, &emptyVAO);
+    emptyVAO = 0;
+    levelsUsed = 0;
+    active = false;
+}
+
+static void allocate(int textureWidth, int textureHeight) {
+    releaseLevels();
+
+    int width = textureWidth, height = textureHeight;
+    for (int i = 0; i < config.levels; ++i) {
+        width = std::max(1, width / 2);
+        height = std::max(1, height / 2);
+        if (i > 0 && std::min(width, height) < minLevelSize)
+            break;
+
+        // No alpha, and half the bandwidth of RGBA16F
+        glGenTextures(1, &levelTextures[i]);
+        glBindTexture(GL_TEXTURE_2D, levelTextures[i]);
+        glTexImage2D(GL_TEXTURE_2D, 0, GL_R11F_G11F_B10F, width, height, 0, GL_RGB, GL_HALF_FLOAT, nullptr);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+
+        glGenFramebuffers(1, &levelFramebuffers[i]);
+        glBindFramebuffer(GL_FRAMEBUFFER, levelFramebuffers[i]);
+        glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, levelTextures[i], 0);
+
+        levelTextureWidth[i] = width;
+        levelTextureHeight[i] = height;
+        ++allocatedLevels;
+    }
+    glBindTexture(GL_TEXTURE_2D, 0);
+
+    allocatedWidth = textureWidth;
+    allocatedHeight = textureHeight;
+}
+
+void renderBloom(GLuint sceneTexture, int width, int height, int textureWidth, int textureHeight) {
+    levelsUsed = 0;
+    sceneTexel = glm::vec2(1.0f / textureWidth, 1.0f / textureHeight);
+    if (!active || config.strength <= 0.0f)
+        return;
+    if (textureWidth != allocatedWidth || textureHeight != allocatedHeight)
+        allocate(textureWidth, textureHeight);
+
+    // The part of each level this frame's scene resolution maps to
+    int levelWidth[maxLevels], levelHeight[maxLevels];
+    for (int i = 0; i < allocatedLevels; ++i) {
+        levelWidth[i] = std::max(1, (i == 0 ? width : levelWidth[i - 1]) / 2);
+        levelHeight[i] = std::max(1, (i == 0 ? height : levelHeight[i - 1]) / 2);
+        if (i > 0 && std::min(levelWidth[i], levelHeight[i]) < minLevelSize)
+            break;
+        ++levelsUsed;
+    }
+
+    glDisable(GL_DEPTH_TEST);
+    glDisable(GL_BLEND);
+    glBindVertexArray(emptyVAO);
+    glActiveTexture(GL_TEXTURE0);
+
+    // Down: the first pass also keeps only what is above the threshold
+    bloomDownsampleProgram.use();
+    bloomDownsampleProgram.set(downsampleKneeUniform, config.threshold * 0.5f);
+    GLuint source = sceneTexture;
+    glm::vec2 sourceScale(float(width) / textureWidth, float(height) / textureHeight);
+    glm::vec2 texel = sceneTexel;
+    for (int i = 0; i < levelsUsed; ++i) {
+        glBindFramebuffer(GL_FRAMEBUFFER, levelFramebuffers[i]);
+        glViewport(0, 0, levelWidth[i], levelHeight[i]);
+        glBindTexture(GL_TEXTURE_2D, source);
+        bloomDownsampleProgram.set(downsampleScaleUniform, sourceScale);
+        bloomDownsampleProgram.set(downsampleTexelUniform, texel);
+        bloomDownsampleProgram.set(downsampleThresholdUniform, i == 0 ? config.threshold : 0.0f);
+        glDrawArrays(GL_TRIANGLES, 0, 3);
+
+        source = levelTextures[i];
+        sourceScale = glm::vec2(float(levelWidth[i]) / levelTextureWidth[i], float(levelHeight[i]) / levelTextureHeight[i]);
+        texel = glm::vec2(1.0f / levelTextureWidth[i], 1.0f / levelTextureHeight[i]);
+    }
+    bloomScale = glm::vec2(float(levelWidth[0]) / levelTextureWidth[0], float(levelHeight[0]) / levelTextureHeight[0]);
+    bloomTexel = glm::vec2(1.0f / levelTextureWidth[0], 1.0f / levelTextureHeight[0]);
+
+    // Up: each level is blurred onto the one above it, so level 0 ends up
+    // with every width of glow added together
+    bloomUpsampleProgram.use();
+    glEnable(GL_BLEND);
+    glBlendFunc(GL_ONE, GL_ONE);
+    for (int i = levelsUsed - 2; i >= 0; --i) {
+        glBindFramebuffer(GL_FRAMEBUFFER, levelFramebuffers[i]);
+        glViewport(0, 0, levelWidth[i], levelHeight[i]);
+        glBindTexture(GL_TEXTURE_2D, levelTextures[i + 1]);
+        bloomUpsampleProgram.set(upsampleScaleUniform,
+                                 glm::vec2(float(levelWidth[i + 1]) / levelTextureWidth[i + 1],
+                                           float(levelHeight[i + 1]) / levelTextureHeight[i + 1]));
+        bloomUpsampleProgram.set(upsampleTexelUniform,
+                                 glm::vec2(1.0f / levelTextureWidth[i + 1], 1.0f / levelTextureHeight[i + 1]));
+        glDrawArrays(GL_TRIANGLES, 0, 3);
+    }
+    glDisable(GL_BLEND);
+    glBindTexture(GL_TEXTURE_2D, 0);
+    glBindVertexArray(0);
+}
+
+void compositeScene(GLuint sceneTexture, float scaleX, float scaleY) {
+    glDisable(GL_DEPTH_TEST);
+    glDisable(GL_BLEND);
+    glBindVertexArray(emptyVAO);
+
+    glActiveTexture(GL_TEXTURE1);
+    glBindTexture(GL_TEXTURE_2D, levelsUsed > 0 ? levelTextures[0] : 0);
+    glActiveTexture(GL_TEXTURE0);
+    glBindTexture(GL_TEXTURE_2D, sceneTexture);
+
+    // Level 0 holds the sum of every level, so the strength is shared out
+    compositeProgram.use();
+    compositeProgram.set(compositeSceneScaleUniform, glm::vec2(scaleX, scaleY));
+    compositeProgram.set(compositeSceneTexelUniform, sceneTexel);
+    compositeProgram.set(compositeBloomScaleUniform, bloomScale);
+    compositeProgram.set(compositeBloomTexelUniform, bloomTexel);
+    compositeProgram.set(compositeStrengthUniform, levelsUsed > 0 ? config.strength / levelsUsed : 0.0f);
+    glDrawArrays(GL_TRIANGLES, 0, 3);
+
+    glActiveTexture(GL_TEXTURE1);
+    glBindTexture(GL_TEXTURE_2D, 0);
+    glActiveTexture(GL_TEXTURE0);
+    glBindTexture(GL_TEXTURE_2D, 0);
+    glBindVertexArray(0);
+    glEnable(GL_DEPTH_TEST);
+}
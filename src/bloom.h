@@ -0,0 +1,32 @@
+#ifndef BLOOM_H
+#define BLOOM_H
+#include <glad/glad.h>
+
+// Glow over the whole scene as one post-process, whatever is in it. The
+// bright parts of the HDR scene are picked out while downsampling to half
+// resolution, blurred down a chain of ever smaller levels with the dual
+// (Kawase) filter, blurred back up and added onto the scene as it is
+// scaled into the window. The cost follows the scene's resolution, not how
+// many bars or particles there are.
+struct BloomConfig {
+    float strength = 1.0f;   // how much glow is added; 0 turns bloom off
+    float threshold = 0.8f;  // brightness the glow starts at
+    int levels = 5;          // half resolution down to 1/32
+};
+
+// Needs the GL context current and the shaders linked
+void initBloom(const BloomConfig& config);
+void destroyBloom();
+
+// Runs the bloom chain over the scene, which fills the bottom-left
+// width x height of sceneTexture, a texture of textureWidth x textureHeight.
+// Does nothing when bloom is off. Leaves one of its framebuffers bound.
+void renderBloom(GLuint sceneTexture, int width, int height, int textureWidth, int textureHeight);
+
+// Draws the scene with its glow into the bound framebuffer's viewport. The
+// scene is the same as given to renderBloom(), with (width, height) as a
+// fraction of the texture in scale. Leaves depth testing on, as the scene
+// passes expect.
+void compositeScene(GLuint sceneTexture, float scaleX, float scaleY);
+
+#endif
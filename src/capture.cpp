@@ -0,0 +1,169 @@
+#include "capture.h"
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstring>
+#include <iostream>
+#include <vector>
+#include "analysis.h"
+#include "audio.h"
+#include "pcm_file.h"
+
+// Room in the driver's capture ring; pollCapture() drains it long before it fills
+const double deviceBufferSeconds = 0.25;
+
+// Fake sources hand out input in blocks, like a device period
+const int fakeBlockFrames = 256;
+
+enum class FakeSource { None, Sine, Wav };
+
+static ALCdevice* captureDevice;
+static FakeSource fakeSource = FakeSource::None;
+static bool active = false;
+
+static std::vector<short> captureChunk;
+static double lastArrival = 0.0;
+
+// Mapped, not loaded; downmixed to mono as it is handed out
+static MappedPcm fakeWav;
+static long long fakeFramesProduced = 0;
+static double fakeStart = 0.0;
+static double sinePhase = 0.0;
+
+// Latency statistics, on the render thread
+static double lastPresented = 0.0;
+static double latencySum = 0.0;
+static double latencyMax = 0.0;
+static int latencyCount = 0;
+static double latencyReportAt = 0.0;
+
+double captureClock() {
+    return std::chrono::duration<double>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+bool startCapture(const CaptureConfig& config) {
+    int rate = config.sampleRate;
+
+    if (config.fake) {
+        if (strcmp(config.fake, "sine") == 0) {
+            fakeSource = FakeSource::Sine;
+        } else {
+            if (!fakeWav.open(config.fake)) {
+                std::cerr << config.fake << ": only 16-bit PCM WAV files are supported\n";
+                return false;
+            }
+            rate = fakeWav.sampleRate;
+            fakeSource = FakeSource::Wav;
+        }
+        fakeStart = captureClock();
+        fakeFramesProduced = 0;
+    } else {
+        ALCsizei bufferFrames = ALCsizei(rate * deviceBufferSeconds);
+        captureDevice = alcCaptureOpenDevice(config.device, rate, AL_FORMAT_MONO16, bufferFrames);
+        if (!captureDevice) {
+            std::cerr << "Failed to open capture device " << (config.device ? config.device : "(default)") << "\n";
+            return false;
+        }
+        alcCaptureStart(captureDevice);
+    }
+
+    sampleRate = rate;
+    channels = 1;
+    captureChunk.resize(size_t(rate * deviceBufferSeconds));
+    active = true;
+    std::clog << "Capturing " << (config.fake ? config.fake : "from device") << " at " << rate << " Hz\n";
+    return true;
+}
+
+void stopCapture() {
+    if (captureDevice) {
+        alcCaptureStop(captureDevice);
+        alcCaptureCloseDevice(captureDevice);
+        captureDevice = nullptr;
+    }
+    fakeWav.close();
+    fakeSource = FakeSource::None;
+    active = false;
+}
+
+bool captureActive() {
+    return active;
+}
+
+// Whatever a real device would have delivered by now, in whole blocks
+static int produceFakeFrames() {
+    long long due = (long long)((captureClock() - fakeStart) * sampleRate);
+    int frames = (int)std::min<long long>(due - fakeFramesProduced, (long long)captureChunk.size());
+    frames -= frames % fakeBlockFrames;
+    if (frames <= 0)
+        return 0;
+
+    for (int i = 0; i < frames; ++i) {
+        long long frame = fakeFramesProduced + i;
+        if (fakeSource == FakeSource::Wav) {
+            const short* samples = fakeWav.frames() + (frame % fakeWav.lengthFrames) * fakeWav.channels;
+            int sum = 0;
+            for (int c = 0; c < fakeWav.channels; ++c)
+                sum += samples[c];
+            captureChunk[i] = short(sum / fakeWav.channels);
+        } else {
+            // Sweeps 30 Hz to 16 kHz and back every 20 seconds
+            double t = std::fmod(double(frame) / sampleRate, 20.0) / 10.0;
+            double frequency = 30.0 * std::pow(16000.0 / 30.0, t < 1.0 ? t : 2.0 - t);
+            sinePhase = std::fmod(sinePhase + 2.0 * M_PI * frequency / sampleRate, 2.0 * M_PI);
+            captureChunk[i] = short(12000.0 * std::sin(sinePhase));
+        }
+    }
+    fakeFramesProduced += frames;
+    return frames;
+}
+
+int pollCapture() {
+    int frames = 0;
+    if (captureDevice) {
+        ALCint available = 0;
+        alcGetIntegerv(captureDevice, ALC_CAPTURE_SAMPLES, 1, &available);
+        frames = std::min<int>(available, (int)captureChunk.size());
+        if (frames > 0)
+            alcCaptureSamples(captureDevice, captureChunk.data(), frames);
+    } else if (fakeSource != FakeSource::None) {
+        frames = produceFakeFrames();
+    }
+
+    if (frames > 0) {
+        appendCapturedFrames(captureChunk.data(), frames);
+        lastArrival = captureClock();
+    }
+    return frames;
+}
+
+double lastCaptureTime() {
+    return lastArrival;
+}
+
+void notePresentedCapture(double capturedAt) {
+    if (capturedAt <= 0.0 || capturedAt == lastPresented)
+        return;
+    lastPresented = capturedAt;
+
+    double now = captureClock();
+    double latency = now - capturedAt;
+    latencySum += latency;
+    latencyMax = std::max(latencyMax, latency);
+    ++latencyCount;
+
+    if (latencyReportAt == 0.0)
+        latencyReportAt = now + 5.0;
+    if (now < latencyReportAt)
+        return;
+
+    // The window is centred half an FFT behind its newest sample, which adds
+    // to what is measured here; device input latency is not visible to us
+    double windowLag = 0.5 * analysisConfig.fftSize / sampleRate;
+    std::clog << "Input to display: avg " << latencySum / latencyCount * 1000.0 << " ms, max "
+              << latencyMax * 1000.0 << " ms, plus " << windowLag * 1000.0 << " ms window centre\n";
+
+    latencySum = latencyMax = 0.0;
+    latencyCount = 0;
+    latencyReportAt = now + 5.0;
+}
@@ -0,0 +1,31 @@
+#ifndef CAPTURE_H
+#define CAPTURE_H
+
+// Live input instead of a file: line-in or a loopback device read through an
+// OpenAL capture device. For testing without hardware a fake source produces
+// the same stream in real time, either a sine sweep or a looped 16-bit WAV.
+struct CaptureConfig {
+    const char* device = nullptr;  // nullptr for the default capture device
+    const char* fake = nullptr;    // "sine" or a .wav path; replaces the device
+    int sampleRate = 48000;        // a WAV file uses its own rate
+};
+
+// Sets sampleRate and channels (mono) for the analysis; reports failures on stderr
+bool startCapture(const CaptureConfig& config);
+void stopCapture();
+bool captureActive();
+
+// Moves whatever input has arrived into the analysis history and returns
+// how many frames that was. Analysis thread only.
+int pollCapture();
+
+// Steady clock in seconds; arrival times and latencies are measured on it
+double captureClock();
+// When the newest frames in the history arrived
+double lastCaptureTime();
+
+// Call after each buffer swap with the arrival time of the input the shown
+// frame was analysed from; prints input-to-display latency every few seconds
+void notePresentedCapture(double capturedAt);
+
+#endif
@@ -0,0 +1,47 @@
+#include "decoder.h"
+#include <algorithm>
+#include <iostream>
+#define STB_VORBIS_IMPLEMENTATION
+#include "../external/stb/stb_vorbis.c"
+
+VorbisStream::~VorbisStream() {
+    close();
+}
+
+bool VorbisStream::open(const char* filename) {
+    close();
+
+    int error = 0;
+    vorbis = stb_vorbis_open_filename(filename, &error, nullptr);
+    if (!vorbis) {
+        std::cerr << "Failed to open " << filename << " (stb_vorbis error " << error << ")\n";
+        return false;
+    }
+
+    stb_vorbis_info info = stb_vorbis_get_info(vorbis);
+    channels = std::min(info.channels, 2);
+    sampleRate = info.sample_rate;
+    lengthFrames = stb_vorbis_stream_length_in_samples(vorbis);
+    return true;
+}
+
+void VorbisStream::close() {
+    if (vorbis) {
+        stb_vorbis_close(vorbis);
+        vorbis = nullptr;
+    }
+}
+
+bool VorbisStream::rewind() {
+    return vorbis && stb_vorbis_seek_start(vorbis);
+}
+
+bool VorbisStream::seek(long long frame) {
+    return vorbis && stb_vorbis_seek(vorbis, (unsigned)frame);
+}
+
+int VorbisStream::read(short* dst, int maxFrames) {
+    if (!vorbis)
+        return 0;
+    return stb_vorbis_get_samples_short_interleaved(vorbis, channels, dst, maxFrames * channels);
+}
@@ -0,0 +1,32 @@
+#ifndef DECODER_H
+#define DECODER_H
+
+struct stb_vorbis;
+
+// Pull-based Ogg Vorbis decoder: hands out interleaved 16-bit chunks on demand
+// instead of decoding the whole file up front. More than two channels are
+// mixed down to stereo so the output always maps onto an OpenAL format.
+class VorbisStream {
+public:
+    ~VorbisStream();
+
+    bool open(const char* filename);
+    void close();
+    bool rewind();
+    // Positions the next read() at the given frame
+    bool seek(long long frame);
+
+    // Decodes up to maxFrames frames into dst; returns frames written, 0 at end
+    int read(short* dst, int maxFrames);
+
+    bool isOpen() const { return vorbis != nullptr; }
+
+    int channels = 0;
+    int sampleRate = 0;
+    long long lengthFrames = 0;
+
+private:
+    stb_vorbis* vorbis = nullptr;
+};
+
+#endif
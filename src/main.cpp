@@ -1,24 +1,288 @@
 #include <glad/glad.h>
 #include <GLFW/glfw3.h>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
 #include <iostream>
-#include <kiss_fft.h>
+#include <string>
+#include <thread>
+#include <vector>
 #include "audio.h"
 #include "renderer.h"
+#include "analysis.h"
+#include "bloom.h"
 #include "shaders.h"
 #include "cleanup.h"
+#include "offline.h"
+#include "outputs.h"
+#include "capture.h"
+#include "profiler.h"
+#include "program_cache.h"
+#include "scene_target.h"
+#include "spectrum_feed.h"
+#include "stream_buffer.h"
 
 
 GLFWwindow* window;
 
+static std::vector<std::string> playlist;
+static OfflineConfig offlineConfig;
+static const char* profilePath = nullptr;
+static CaptureConfig captureConfig;
+static bool capture = false;
+static bool useIndex = true;
+static bool useShaderCache = true;
+static const char* feedName = nullptr;
+static SceneTargetConfig sceneTargetConfig;
+static BloomConfig bloomConfig;
+static bool vsync = true;
+// Windows to show the scene in, one per screen
+static int screens = 1;
+// Extra windows wait for their own vblank unless turned off; see outputs.h
+static bool outputVsync = true;
+// Frame rate cap for when vsync is off; 0 for none
+static double maxFps = 0.0;
 
-int main() {
+// Kept up to date by the framebuffer size callback
+static int framebufferWidth, framebufferHeight;
+
+// Arrow keys seek by this much
+static const double seekStep = 5.0;
+
+static void printUsage() {
+    std::cerr << "Usage: carousel [--input FILE]... [--playlist FILE.m3u] [--fft N] [--hop N] [--bars N] [--scale linear|log|mel]\n"
+                 "                [--cpu-particles] [--no-index] [--no-shader-cache] [--offline OUTPUT|-] [--size WxH] [--fps N]\n"
+                 "                [--profile TRACE.json] [--capture DEVICE|default] [--fake-capture sine|FILE.wav]\n"
+                 "                [--capture-rate HZ] [--frame-target MS] [--min-scale F] [--bloom F]\n"
+                 "                [--no-vsync] [--max-fps N] [--screens N] [--no-output-vsync]\n"
+                 "                [--feed NAME|default]\n";
+}
+
+// One path per line, relative to the list; blank lines and # comments are skipped
+static bool readPlaylist(const char* path) {
+    std::ifstream file(path);
+    if (!file) {
+        std::cerr << "Cannot open playlist " << path << "\n";
+        return false;
+    }
+
+    std::string directory(path);
+    size_t slash = directory.find_last_of('/');
+    directory = slash == std::string::npos ? "" : directory.substr(0, slash + 1);
+
+    std::string line;
+    while (std::getline(file, line)) {
+        if (!line.empty() && line.back() == '\r')
+            line.pop_back();
+        if (line.empty() || line[0] == '#')
+            continue;
+        playlist.push_back(line[0] == '/' ? line : directory + line);
+    }
+    return true;
+}
+
+static bool parseArguments(int argc, char** argv) {
+    for (int i = 1; i < argc; ++i) {
+        const char* arg = argv[i];
+        if (strcmp(arg, "--cpu-particles") == 0) {
+            particleSimulation = ParticleSimulation::Cpu;
+            continue;
+        }
+        if (strcmp(arg, "--no-index") == 0) {
+            useIndex = false;
+            continue;
+        }
+        if (strcmp(arg, "--no-vsync") == 0) {
+            vsync = false;
+            continue;
+        }
+        if (strcmp(arg, "--no-output-vsync") == 0) {
+            outputVsync = false;
+            continue;
+        }
+        if (strcmp(arg, "--no-shader-cache") == 0) {
+            useShaderCache = false;
+            continue;
+        }
+
+        const char* value = i + 1 < argc ? argv[i + 1] : nullptr;
+        if (!value) {
+            printUsage();
+            return false;
+        }
+
+        if (strcmp(arg, "--input") == 0) {
+            playlist.push_back(value);
+        } else if (strcmp(arg, "--playlist") == 0) {
+            if (!readPlaylist(value))
+                return false;
+        } else if (strcmp(arg, "--offline") == 0) {
+            offlineConfig.output = value;
+        } else if (strcmp(arg, "--size") == 0) {
+            if (sscanf(value, "%dx%d", &offlineConfig.width, &offlineConfig.height) != 2 ||
+                offlineConfig.width <= 0 || offlineConfig.height <= 0) {
+                printUsage();
+                return false;
+            }
+        } else if (strcmp(arg, "--fps") == 0) {
+            offlineConfig.fps = atoi(value);
+            if (offlineConfig.fps <= 0) {
+                printUsage();
+                return false;
+            }
+        } else if (strcmp(arg, "--capture") == 0) {
+            capture = true;
+            captureConfig.device = strcmp(value, "default") == 0 ? nullptr : value;
+        } else if (strcmp(arg, "--fake-capture") == 0) {
+            capture = true;
+            captureConfig.fake = value;
+        } else if (strcmp(arg, "--capture-rate") == 0) {
+            captureConfig.sampleRate = atoi(value);
+            if (captureConfig.sampleRate <= 0) {
+                printUsage();
+                return false;
+            }
+        } else if (strcmp(arg, "--frame-target") == 0) {
+            sceneTargetConfig.targetMillis = atof(value);
+            if (sceneTargetConfig.targetMillis < 0.0) {
+                printUsage();
+                return false;
+            }
+        } else if (strcmp(arg, "--min-scale") == 0) {
+            sceneTargetConfig.minScale = float(atof(value));
+            if (sceneTargetConfig.minScale <= 0.0f || sceneTargetConfig.minScale > 1.0f) {
+                printUsage();
+                return false;
+            }
+        } else if (strcmp(arg, "--screens") == 0) {
+            screens = atoi(value);
+            if (screens < 1 || screens > 16) {
+                printUsage();
+                return false;
+            }
+        } else if (strcmp(arg, "--max-fps") == 0) {
+            maxFps = atof(value);
+            if (maxFps < 0.0) {
+                printUsage();
+                return false;
+            }
+        } else if (strcmp(arg, "--bloom") == 0) {
+            bloomConfig.strength = float(atof(value));
+            if (bloomConfig.strength < 0.0f) {
+                printUsage();
+                return false;
+            }
+        } else if (strcmp(arg, "--feed") == 0) {
+            feedName = strcmp(value, "default") == 0 ? defaultFeedName : value;
+        } else if (strcmp(arg, "--profile") == 0) {
+            profilePath = value;
+        } else if (strcmp(arg, "--fft") == 0) {
+            analysisConfig.fftSize = atoi(value);
+        } else if (strcmp(arg, "--hop") == 0) {
+            analysisConfig.hopSize = atoi(value);
+        } else if (strcmp(arg, "--bars") == 0) {
+            analysisConfig.numBars = atoi(value);
+        } else if (strcmp(arg, "--scale") == 0) {
+            if (strcmp(value, "linear") == 0)
+                analysisConfig.barScale = BarScale::Linear;
+            else if (strcmp(value, "log") == 0)
+                analysisConfig.barScale = BarScale::Log;
+            else if (strcmp(value, "mel") == 0)
+                analysisConfig.barScale = BarScale::Mel;
+            else {
+                printUsage();
+                return false;
+            }
+        } else {
+            printUsage();
+            return false;
+        }
+        ++i;
+    }
+    if (playlist.empty())
+        playlist.push_back("../assets/willow.ogg");
+    if (capture && offlineConfig.output) {
+        std::cerr << "Live capture cannot be rendered offline\n";
+        return false;
+    }
+    return validateAnalysisConfig(analysisConfig);
+}
+
+// Sleeps until the next frame is due. Sleeps can overshoot by a scheduler
+// tick, so the last millisecond is spun instead.
+static void paceFrame(double& deadline) {
+    const double interval = 1.0 / maxFps;
+    deadline += interval;
+    double now = glfwGetTime();
+    // More than a frame behind: start again from now rather than rush
+    if (now - deadline > interval)
+        deadline = now;
+
+    double sleep = deadline - now - 0.001;
+    if (sleep > 0.0)
+        std::this_thread::sleep_for(std::chrono::duration<double>(sleep));
+    while (glfwGetTime() < deadline) {
+    }
+}
+
+// Closing any of the windows ends the show
+static bool windowClosed() {
+    if (glfwWindowShouldClose(window))
+        return true;
+    for (int i = 0; i < extraOutputCount(); ++i) {
+        if (glfwWindowShouldClose(outputWindow(i)))
+            return true;
+    }
+    return false;
+}
+
+static void framebufferSizeCallback(GLFWwindow*, int width, int height) {
+    framebufferWidth = width;
+    framebufferHeight = height;
+}
+
+static void keyCallback(GLFWwindow*, int key, int, int action, int) {
+    if (action == GLFW_RELEASE)
+        return;
+    if (key == GLFW_KEY_LEFT)
+        seekAudio(-seekStep);
+    else if (key == GLFW_KEY_RIGHT)
+        seekAudio(seekStep);
+}
+
+int main(int argc, char** argv) {
+    if (!parseArguments(argc, argv))
+        return -1;
+
+    const bool offline = offlineConfig.output != nullptr;
+
+#ifdef GLFW_PLATFORM_NULL
+    // Offline rendering must not need a display server
+    if (offline)
+        glfwInitHint(GLFW_PLATFORM, GLFW_PLATFORM_NULL);
+#endif
 
     if (!glfwInit()) {
         std::cerr << "GLFW init failed\n";
         return -1;
     }
 
-    window = glfwCreateWindow(1600, 900, "Carousel", nullptr, nullptr);
+    // Everything is drawn with #version 330 core shaders; no legacy GL
+    glfwWindowHint(GLFW_CONTEXT_VERSION_MAJOR, 3);
+    glfwWindowHint(GLFW_CONTEXT_VERSION_MINOR, 3);
+    glfwWindowHint(GLFW_OPENGL_PROFILE, GLFW_OPENGL_CORE_PROFILE);
+    glfwWindowHint(GLFW_OPENGL_FORWARD_COMPAT, GLFW_TRUE);
+
+    if (offline) {
+        // Software OSMesa context, never shown; frames go to an FBO
+        glfwWindowHint(GLFW_VISIBLE, GLFW_FALSE);
+        glfwWindowHint(GLFW_CONTEXT_CREATION_API, GLFW_OSMESA_CONTEXT_API);
+        window = glfwCreateWindow(offlineConfig.width, offlineConfig.height, "Carousel", nullptr, nullptr);
+    } else {
+        window = glfwCreateWindow(1600, 900, "Carousel", nullptr, nullptr);
+    }
     if (!window) {
         std::cerr << "Window creation failed\n";
         glfwTerminate();
@@ -26,31 +290,131 @@ int main() {
     }
 
     glfwMakeContextCurrent(window);
-    glfwSwapInterval(1);
+    if (!offline)
+        glfwSwapInterval(vsync ? 1 : 0);
 
     initOpenGL();
-    createShaders();
-    setupBars();
+    // Links in the background where the driver allows; audio starts meanwhile
+    createShaders(useShaderCache ? defaultProgramCachePath() : "");
+    initProfiler(profilePath != nullptr);
+
+    if (capture) {
+        if (!startCapture(captureConfig)) {
+            cleanup();
+            glfwTerminate();
+            return -1;
+        }
+    } else {
+        // Offline renders the first track and has its index built up front
+        loadAudio(playlist, useIndex, !offline);
+    }
+
+    if (feedName && !startSpectrumFeed(feedName)) {
+        cleanup();
+        glfwTerminate();
+        return -1;
+    }
+
+    if (!offline) {
+        if (!capture) {
+            initOpenAL();
+            playAudio();
+            glfwSetKeyCallback(window, keyCallback);
+        }
+        startAnalysis();
+
+        // An empty window that stays responsive until every program is linked
+        while (!shadersReady()) {
+            glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+            glfwSwapBuffers(window);
+            glfwPollEvents();
+        }
+    } else {
+        finishShaders();
+    }
+
+    setupBarMesh();
     setupBaseCircle();
-    renderBaseCircle();
-    loadAudio("../assets/willow.ogg");
-    initOpenAL();
-    playAudio();
+    setupParticles();
 
-    while (!glfwWindowShouldClose(window)) {
-    processAudioFrame();
-    float time = glfwGetTime();
+    // Offline frames always render at full resolution
+    if (offline)
+        sceneTargetConfig.targetMillis = 0.0;
+    initSceneTarget(sceneTargetConfig);
+    initBloom(bloomConfig);
 
-    glUseProgram(shaderProgram);
-    glUniform1f(glGetUniformLocation(shaderProgram, "time"), time);
+    if (offline) {
+        int result = runOffline(offlineConfig);
+        cleanup();
+        if (profilePath)
+            writeProfileTrace(profilePath);
+        glfwTerminate();
+        return result;
+    }
 
-    renderScene();
+    glfwGetFramebufferSize(window, &framebufferWidth, &framebufferHeight);
+    glfwSetFramebufferSizeCallback(window, framebufferSizeCallback);
 
-    glfwSwapBuffers(window);
+    if (!openOutputs(window, screens, outputVsync)) {
+        cleanup();
+        glfwTerminate();
+        return -1;
+    }
+    for (int i = 0; i < extraOutputCount() && !capture; ++i)
+        glfwSetKeyCallback(outputWindow(i), keyCallback);
+
+    bool firstFramePresented = false;
+    double frameDeadline = glfwGetTime();
+    while (!windowClosed()) {
+    // Nothing to draw into while every window is minimised; audio and
+    // analysis carry on. A minimised main window still leaves the others.
+    const bool mainDrawable = framebufferWidth > 0 && framebufferHeight > 0;
+    if (!mainDrawable && !outputsDrawable()) {
+        glfwWaitEvents();
+        continue;
+    }
+
+    beginProfilerFrame();
+    updateScene(glfwGetTime());
+
+    // One simulated state, a view of it per screen; the main window's last
+    beginSceneFrame();
+    renderOutputs();
+    if (mainDrawable) {
+        beginSceneTarget(framebufferWidth, framebufferHeight);
+        renderScene();
+        endSceneTarget();
+    }
+    endSceneFrame();
+
+    if (mainDrawable && profilerEnabled())
+        renderProfilerOverlay(framebufferWidth, framebufferHeight);
+    streamBuffer.endFrame();
+
+    {
+        ProfileScope scope("swap");
+        // Minimised, main's swap would not wait for anything; the others pace the loop
+        if (mainDrawable)
+            glfwSwapBuffers(window);
+        else
+            waitForOutputs();
+    }
+    if (maxFps > 0.0) {
+        ProfileScope scope("pace");
+        paceFrame(frameDeadline);
+    }
+    if (capture)
+        notePresentedCapture(displayedCaptureTime());
+    if (!firstFramePresented) {
+        firstFramePresented = true;
+        std::clog << "First frame after " << glfwGetTime() * 1000.0 << " ms\n";
+    }
     glfwPollEvents();
+    endProfilerFrame();
 }
 
     cleanup();
+    if (profilePath)
+        writeProfileTrace(profilePath);
     return 0;
 }
-
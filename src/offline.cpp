@@ -0,0 +1,134 @@
+#include "offline.h"
+#include <glad/glad.h>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <iostream>
+#include "analysis.h"
+#include "audio.h"
+#include "profiler.h"
+#include "stream_buffer.h"
+#include "renderer.h"
+#include "scene_target.h"
+
+// Frames in flight between glReadPixels and writing them out
+const int readbackDepth = 3;
+
+static bool writeFrame(GLuint pbo, size_t frameBytes, FILE* out) {
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, pbo);
+    void* pixels = glMapBufferRange(GL_PIXEL_PACK_BUFFER, 0, frameBytes, GL_MAP_READ_BIT);
+    bool ok = pixels && fwrite(pixels, 1, frameBytes, out) == frameBytes;
+    glUnmapBuffer(GL_PIXEL_PACK_BUFFER);
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+    return ok;
+}
+
+int runOffline(const OfflineConfig& config) {
+    const bool toStdout = strcmp(config.output, "-") == 0;
+    FILE* out = toStdout ? stdout : fopen(config.output, "wb");
+    if (!out) {
+        std::cerr << "Cannot open " << config.output << " for writing\n";
+        return -1;
+    }
+
+    const int width = config.width;
+    const int height = config.height;
+    const size_t frameBytes = size_t(width) * height * 4;
+
+    GLuint fbo, colorBuffer, depthBuffer;
+    glGenFramebuffers(1, &fbo);
+    glGenRenderbuffers(1, &colorBuffer);
+    glGenRenderbuffers(1, &depthBuffer);
+
+    glBindRenderbuffer(GL_RENDERBUFFER, colorBuffer);
+    glRenderbufferStorage(GL_RENDERBUFFER, GL_RGBA8, width, height);
+    glBindRenderbuffer(GL_RENDERBUFFER, depthBuffer);
+    glRenderbufferStorage(GL_RENDERBUFFER, GL_DEPTH_COMPONENT24, width, height);
+    glBindRenderbuffer(GL_RENDERBUFFER, 0);
+
+    glBindFramebuffer(GL_FRAMEBUFFER, fbo);
+    glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_RENDERBUFFER, colorBuffer);
+    glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_RENDERBUFFER, depthBuffer);
+    if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE) {
+        std::cerr << "Offline framebuffer is incomplete\n";
+        glBindFramebuffer(GL_FRAMEBUFFER, 0);
+        glDeleteFramebuffers(1, &fbo);
+        glDeleteRenderbuffers(1, &colorBuffer);
+        glDeleteRenderbuffers(1, &depthBuffer);
+        if (!toStdout)
+            fclose(out);
+        return -1;
+    }
+
+    GLuint pbo[readbackDepth];
+    glGenBuffers(readbackDepth, pbo);
+    for (int i = 0; i < readbackDepth; ++i) {
+        glBindBuffer(GL_PIXEL_PACK_BUFFER, pbo[i]);
+        glBufferData(GL_PIXEL_PACK_BUFFER, frameBytes, nullptr, GL_STREAM_READ);
+    }
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+
+    startOfflineAnalysis(1.0 / config.fps);
+
+    const long long totalFrames = (audioLengthFrames() * config.fps + sampleRate - 1) / sampleRate;
+    bool ok = true;
+
+    auto started = std::chrono::steady_clock::now();
+    for (long long i = 0; i < totalFrames && ok; ++i) {
+        double time = double(i) / config.fps;
+        beginProfilerFrame();
+
+        double trackTime;
+        if (!spectrogramIndexAt(time, trackTime)) {
+            ProfileScope scope("decode");
+            decodeAudioUntil((long long)(time * sampleRate) + analysisConfig.fftSize);
+        }
+        analyseAt(time);
+
+        // Through the scene target, so frames get the same bloom as on screen
+        updateScene(time);
+        beginSceneFrame();
+        beginSceneTarget(width, height);
+        renderScene();
+        endSceneTarget(fbo);
+        endSceneFrame();
+
+        // Start this frame's readback; it is written out readbackDepth - 1
+        // frames later, by which time the copy has long finished
+        glBindBuffer(GL_PIXEL_PACK_BUFFER, pbo[i % readbackDepth]);
+        glReadPixels(0, 0, width, height, GL_RGBA, GL_UNSIGNED_BYTE, nullptr);
+        glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+        streamBuffer.endFrame();
+
+        if (i >= readbackDepth - 1) {
+            ProfileScope scope("write frame");
+            ok = writeFrame(pbo[(i + 1) % readbackDepth], frameBytes, out);
+        }
+        endProfilerFrame();
+    }
+
+    // Drain the frames still in flight
+    long long first = totalFrames > readbackDepth - 1 ? totalFrames - (readbackDepth - 1) : 0;
+    for (long long i = first; i < totalFrames && ok; ++i)
+        ok = writeFrame(pbo[i % readbackDepth], frameBytes, out);
+
+    double elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - started).count();
+    double trackSeconds = double(totalFrames) / config.fps;
+    std::cerr << "Rendered " << totalFrames << " frames (" << width << "x" << height << " @ " << config.fps
+              << " fps) in " << elapsed << " s, " << (elapsed > 0.0 ? trackSeconds / elapsed : 0.0)
+              << "x real time\n";
+    if (!ok)
+        std::cerr << "Writing frames to " << config.output << " failed\n";
+
+    glBindFramebuffer(GL_FRAMEBUFFER, 0);
+    glDeleteBuffers(readbackDepth, pbo);
+    glDeleteFramebuffers(1, &fbo);
+    glDeleteRenderbuffers(1, &colorBuffer);
+    glDeleteRenderbuffers(1, &depthBuffer);
+
+    if (!toStdout)
+        fclose(out);
+    else
+        fflush(out);
+    return ok ? 0 : -1;
+}
@@ -0,0 +1,17 @@
+#ifndef OFFLINE_H
+#define OFFLINE_H
+
+struct OfflineConfig {
+    const char* output = nullptr;  // file path, "-" for stdout; null = realtime
+    int width = 1920;
+    int height = 1080;
+    int fps = 60;
+};
+
+// Renders the whole loaded track on a fixed timestep into an offscreen
+// framebuffer and writes raw RGBA frames (bottom row first) to the output.
+// Needs a current GL context with shaders, meshes, the scene target and
+// bloom set up, and no audio device; returns the process exit code.
+int runOffline(const OfflineConfig& config);
+
+#endif
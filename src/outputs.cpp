@@ -0,0 +1,270 @@
+#include "outputs.h"
+#include <glad/glad.h>
+#include <GLFW/glfw3.h>
+#include <chrono>
+#include <condition_variable>
+#include <cstdio>
+#include <iostream>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include "renderer.h"
+#include "scene_target.h"
+#include "shaders.h"
+
+// One view as drawn by main, in main's context: composited into texture
+// through framebuffer, at the window's size when it was drawn
+struct OutputImage {
+    GLuint framebuffer = 0;
+    GLuint texture = 0;
+    int width = 0, height = 0;
+    // Main's drawing of it is done; the output's thread waits on this
+    GLsync drawn = nullptr;
+    // The output's copy of it is done; main waits on this before drawing again
+    GLsync shown = nullptr;
+};
+
+// Three images, so main always has one to draw into while one waits to be
+// shown and another is being copied
+const int imageCount = 3;
+
+struct Output {
+    GLFWwindow* window = nullptr;
+    float orbitOffset = 0.0f;
+    OutputImage images[imageCount];
+    // Drawn by main this frame, or -1
+    int drawing = -1;
+
+    // Shared with the output's thread: the newest image not yet taken, the
+    // one being copied, each -1 for none
+    std::mutex mutex;
+    std::condition_variable wake;
+    int ready = -1;
+    int showing = -1;
+    bool running = true;
+    std::thread thread;
+};
+
+static std::vector<Output*> outputs;
+static bool outputVsync = true;
+
+// Runs with the window's context current for as long as it is open. Each
+// image main hands over is copied in and swapped, waiting for vblank unless
+// vsync is off, without ever holding up main.
+static void presentLoop(Output* output) {
+    glfwMakeContextCurrent(output->window);
+    glfwSwapInterval(outputVsync ? 1 : 0);
+    // VAOs are not shared between contexts
+    GLuint vao;
+    glGenVertexArrays(1, &vao);
+
+    std::unique_lock<std::mutex> lock(output->mutex);
+    while (true) {
+        output->wake.wait(lock, [output] { return output->ready >= 0 || !output->running; });
+        if (!output->running)
+            break;
+        OutputImage& image = output->images[output->ready];
+        output->showing = output->ready;
+        output->ready = -1;
+        lock.unlock();
+        output->wake.notify_all();
+
+        // The GPU waits for main's drawing; this thread carries on
+        glWaitSync(image.drawn, 0, GL_TIMEOUT_IGNORED);
+        glDeleteSync(image.drawn);
+        image.drawn = nullptr;
+
+        glViewport(0, 0, image.width, image.height);
+        presentProgram.use();
+        glBindVertexArray(vao);
+        glActiveTexture(GL_TEXTURE0);
+        glBindTexture(GL_TEXTURE_2D, image.texture);
+        glDrawArrays(GL_TRIANGLES, 0, 3);
+        glBindVertexArray(0);
+        image.shown = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+        glFlush();
+
+        lock.lock();
+        output->showing = -1;
+        lock.unlock();
+        glfwSwapBuffers(output->window);
+        lock.lock();
+    }
+    lock.unlock();
+
+    glDeleteVertexArrays(1, &vao);
+    glfwMakeContextCurrent(nullptr);
+}
+
+bool openOutputs(GLFWwindow* main, int count, bool vsync) {
+    outputVsync = vsync;
+
+    int width, height;
+    glfwGetWindowSize(main, &width, &height);
+    int monitorCount = 0;
+    GLFWmonitor** monitors = glfwGetMonitors(&monitorCount);
+
+    for (int i = 1; i < count; ++i) {
+        char title[32];
+        snprintf(title, sizeof(title), "Carousel %d", i + 1);
+
+        GLFWwindow* window = glfwCreateWindow(width, height, title, nullptr, main);
+        if (!window) {
+            std::cerr << "Output window " << i + 1 << " could not be created\n";
+            closeOutputs();
+            return false;
+        }
+        if (i < monitorCount) {
+            int x, y;
+            glfwGetMonitorPos(monitors[i], &x, &y);
+            glfwSetWindowPos(window, x + 50, y + 50);
+        }
+
+        Output* output = new Output;
+        output->window = window;
+        // Spread evenly round the orbit, main at the start of it
+        output->orbitOffset = 6.2831853f * i / count;
+        for (OutputImage& image : output->images) {
+            glGenFramebuffers(1, &image.framebuffer);
+            glGenTextures(1, &image.texture);
+        }
+        outputs.push_back(output);
+    }
+
+    presentProgram.use();
+    presentProgram.set(presentProgram.uniform("frame"), 0);
+    glUseProgram(0);
+
+    // Started once the program is set up, which they share with main
+    for (Output* output : outputs)
+        output->thread = std::thread(presentLoop, output);
+    return true;
+}
+
+void closeOutputs() {
+    for (Output* output : outputs) {
+        {
+            std::lock_guard<std::mutex> lock(output->mutex);
+            output->running = false;
+        }
+        output->wake.notify_all();
+        if (output->thread.joinable())
+            output->thread.join();
+    }
+
+    for (Output* output : outputs) {
+        for (OutputImage& image : output->images) {
+            if (image.drawn)
+                glDeleteSync(image.drawn);
+            if (image.shown)
+                glDeleteSync(image.shown);
+            glDeleteFramebuffers(1, &image.framebuffer);
+            glDeleteTextures(1, &image.texture);
+        }
+        glfwDestroyWindow(output->window);
+        delete output;
+    }
+    outputs.clear();
+}
+
+int extraOutputCount() {
+    return int(outputs.size());
+}
+
+GLFWwindow* outputWindow(int index) {
+    return outputs[index]->window;
+}
+
+bool outputsDrawable() {
+    for (Output* output : outputs) {
+        int width, height;
+        glfwGetFramebufferSize(output->window, &width, &height);
+        if (width > 0 && height > 0)
+            return true;
+    }
+    return false;
+}
+
+static void allocate(OutputImage& image, int width, int height) {
+    glBindTexture(GL_TEXTURE_2D, image.texture);
+    glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA8, width, height, 0, GL_RGBA, GL_UNSIGNED_BYTE, nullptr);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+    glBindTexture(GL_TEXTURE_2D, 0);
+
+    glBindFramebuffer(GL_FRAMEBUFFER, image.framebuffer);
+    glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, image.texture, 0);
+    if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE)
+        std::cerr << "Output framebuffer incomplete at " << width << "x" << height << "\n";
+    glBindFramebuffer(GL_FRAMEBUFFER, 0);
+
+    image.width = width;
+    image.height = height;
+}
+
+// An image that is neither waiting to be shown nor being copied
+static int freeImage(Output& output) {
+    std::lock_guard<std::mutex> lock(output.mutex);
+    for (int i = 0; i < imageCount; ++i) {
+        if (i != output.ready && i != output.showing)
+            return i;
+    }
+    return -1;
+}
+
+void renderOutputs() {
+    if (outputs.empty())
+        return;
+
+    for (Output* output : outputs) {
+        output->drawing = -1;
+        // Nothing to draw into while minimised
+        int width, height;
+        glfwGetFramebufferSize(output->window, &width, &height);
+        if (width <= 0 || height <= 0)
+            continue;
+
+        int index = freeImage(*output);
+        OutputImage& image = output->images[index];
+        if (image.shown) {
+            glWaitSync(image.shown, 0, GL_TIMEOUT_IGNORED);
+            glDeleteSync(image.shown);
+            image.shown = nullptr;
+        }
+        // Replaced by a newer image before the output took it
+        if (image.drawn) {
+            glDeleteSync(image.drawn);
+            image.drawn = nullptr;
+        }
+        if (width != image.width || height != image.height)
+            allocate(image, width, height);
+
+        beginSceneTarget(width, height);
+        renderScene(output->orbitOffset);
+        endSceneTarget(image.framebuffer);
+        image.drawn = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+        output->drawing = index;
+    }
+    glBindFramebuffer(GL_FRAMEBUFFER, 0);
+
+    // Flushed so the other contexts can wait on the fences
+    glFlush();
+    for (Output* output : outputs) {
+        if (output->drawing < 0)
+            continue;
+        {
+            std::lock_guard<std::mutex> lock(output->mutex);
+            output->ready = output->drawing;
+        }
+        output->wake.notify_all();
+    }
+}
+
+void waitForOutputs() {
+    // Bounded, so a window that never swaps cannot stall the rest
+    const auto timeout = std::chrono::milliseconds(100);
+    for (Output* output : outputs) {
+        std::unique_lock<std::mutex> lock(output->mutex);
+        output->wake.wait_for(lock, timeout, [output] { return output->ready < 0; });
+    }
+}
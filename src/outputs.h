@@ -0,0 +1,39 @@
+#ifndef OUTPUTS_H
+#define OUTPUTS_H
+struct GLFWwindow;
+
+// Extra windows, one per screen, each showing the scene from its own point
+// round the camera's orbit. There is still one decode, one FFT and one
+// simulation step per frame; only the drawing is repeated per view, and
+// every screen shows the same step.
+//
+// All views are drawn in the main window's context, which holds the only
+// meshes, programs, particle buffers and stream buffer; each extra view is
+// composited into a texture there. Each extra window has a thread of its
+// own with its context current, sharing those objects with main, which
+// copies the newest texture in and swaps. With vsync that swap waits for
+// the window's own monitor, so the outputs never tear and never hold up
+// main; an output may show a frame one of its refreshes after main does.
+// Without vsync they swap as soon as a frame arrives, closer to main but
+// tearing.
+
+// Opens count - 1 windows sharing main's context, spread over the monitors
+// when there are enough of them, and starts their threads. Needs the
+// shaders ready and main's context current.
+bool openOutputs(GLFWwindow* main, int count, bool vsync);
+void closeOutputs();
+
+// The extra windows, not counting main
+int extraOutputCount();
+GLFWwindow* outputWindow(int index);
+// Whether any extra window is large enough to draw into
+bool outputsDrawable();
+
+// Draws every extra view into a free texture and hands it to the window's
+// thread; in main's context, between beginSceneFrame() and endSceneFrame()
+void renderOutputs();
+// Waits, for up to 100 ms, until the windows have taken the last views.
+// Paces the frame loop when main's own swap does not.
+void waitForOutputs();
+
+#endif
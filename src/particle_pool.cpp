@@ -0,0 +1,180 @@
+#include "particle_pool.h"
+#include <algorithm>
+#include <cmath>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#elif defined(__ARM_NEON)
+#include <arm_neon.h>
+#endif
+
+static_assert(sizeof(Particle) == 8 * sizeof(float), "Particle must match the shader layout");
+
+ParticlePool::ParticlePool(int capacity)
+    : capacity(capacity),
+      px(capacity), py(capacity), pz(capacity),
+      vx(capacity), vy(capacity), vz(capacity),
+      life(capacity), sizes(capacity) {}
+
+bool ParticlePool::spawn(const glm::vec3& position, const glm::vec3& velocity, float size) {
+    if (count == capacity)
+        return false;
+
+    px[count] = position.x; py[count] = position.y; pz[count] = position.z;
+    vx[count] = velocity.x; vy[count] = velocity.y; vz[count] = velocity.z;
+    life[count] = 1.0f;
+    sizes[count] = size;
+    ++count;
+    return true;
+}
+
+// Same integration as the transform feedback shader: the velocity picks up a
+// push along the unit tangent (-y, x), then moves the particle
+void ParticlePool::update(float deltaTime) {
+    float* __restrict x = px.data();
+    float* __restrict y = py.data();
+    float* __restrict z = pz.data();
+    float* __restrict u = vx.data();
+    float* __restrict v = vy.data();
+    float* __restrict w = vz.data();
+    float* __restrict l = life.data();
+
+    const float push = 0.2f * deltaTime;
+    const float decay = 0.5f * deltaTime;
+
+    int i = 0;
+#if defined(__SSE2__)
+    const __m128 vPush = _mm_set1_ps(push);
+    const __m128 vDt = _mm_set1_ps(deltaTime);
+    const __m128 vDecay = _mm_set1_ps(decay);
+    const __m128 tiny = _mm_set1_ps(1e-12f);
+    const __m128 half = _mm_set1_ps(0.5f);
+    const __m128 threeHalves = _mm_set1_ps(1.5f);
+
+    for (; i + 4 <= count; i += 4) {
+        __m128 x4 = _mm_loadu_ps(x + i), y4 = _mm_loadu_ps(y + i);
+
+        // 1 / |(-y, x)| from rsqrt plus one Newton step
+        __m128 len2 = _mm_add_ps(_mm_add_ps(_mm_mul_ps(x4, x4), _mm_mul_ps(y4, y4)), tiny);
+        __m128 r = _mm_rsqrt_ps(len2);
+        r = _mm_mul_ps(r, _mm_sub_ps(threeHalves, _mm_mul_ps(_mm_mul_ps(half, len2), _mm_mul_ps(r, r))));
+        __m128 scale = _mm_mul_ps(r, vPush);
+
+        __m128 u4 = _mm_sub_ps(_mm_loadu_ps(u + i), _mm_mul_ps(y4, scale));
+        __m128 v4 = _mm_add_ps(_mm_loadu_ps(v + i), _mm_mul_ps(x4, scale));
+        __m128 w4 = _mm_loadu_ps(w + i);
+        _mm_storeu_ps(u + i, u4);
+        _mm_storeu_ps(v + i, v4);
+
+        _mm_storeu_ps(x + i, _mm_add_ps(x4, _mm_mul_ps(u4, vDt)));
+        _mm_storeu_ps(y + i, _mm_add_ps(y4, _mm_mul_ps(v4, vDt)));
+        _mm_storeu_ps(z + i, _mm_add_ps(_mm_loadu_ps(z + i), _mm_mul_ps(w4, vDt)));
+        _mm_storeu_ps(l + i, _mm_sub_ps(_mm_loadu_ps(l + i), vDecay));
+    }
+#elif defined(__ARM_NEON)
+    for (; i + 4 <= count; i += 4) {
+        float32x4_t x4 = vld1q_f32(x + i), y4 = vld1q_f32(y + i);
+
+        float32x4_t len2 = vaddq_f32(vmlaq_f32(vmulq_f32(x4, x4), y4, y4), vdupq_n_f32(1e-12f));
+        float32x4_t r = vrsqrteq_f32(len2);
+        r = vmulq_f32(r, vrsqrtsq_f32(vmulq_f32(len2, r), r));
+        float32x4_t scale = vmulq_n_f32(r, push);
+
+        float32x4_t u4 = vmlsq_f32(vld1q_f32(u + i), y4, scale);
+        float32x4_t v4 = vmlaq_f32(vld1q_f32(v + i), x4, scale);
+        vst1q_f32(u + i, u4);
+        vst1q_f32(v + i, v4);
+
+        vst1q_f32(x + i, vmlaq_n_f32(x4, u4, deltaTime));
+        vst1q_f32(y + i, vmlaq_n_f32(y4, v4, deltaTime));
+        vst1q_f32(z + i, vmlaq_n_f32(vld1q_f32(z + i), vld1q_f32(w + i), deltaTime));
+        vst1q_f32(l + i, vsubq_f32(vld1q_f32(l + i), vdupq_n_f32(decay)));
+    }
+#endif
+    for (; i < count; ++i) {
+        float scale = push / std::sqrt(x[i] * x[i] + y[i] * y[i] + 1e-12f);
+        u[i] -= y[i] * scale;
+        v[i] += x[i] * scale;
+        x[i] += u[i] * deltaTime;
+        y[i] += v[i] * deltaTime;
+        z[i] += w[i] * deltaTime;
+        l[i] -= decay;
+    }
+
+    // Swap-with-last removal keeps the live range dense without shifting
+    for (int j = 0; j < count;) {
+        if (l[j] > 0.0f) {
+            ++j;
+            continue;
+        }
+        --count;
+        x[j] = x[count]; y[j] = y[count]; z[j] = z[count];
+        u[j] = u[count]; v[j] = v[count]; w[j] = w[count];
+        l[j] = l[count];
+        sizes[j] = sizes[count];
+    }
+}
+
+void ParticlePool::pack(Particle* dst) const {
+    for (int i = 0; i < count; ++i)
+        dst[i] = { glm::vec3(px[i], py[i], pz[i]), glm::vec3(vx[i], vy[i], vz[i]), life[i], sizes[i] };
+}
+
+// Emission angles come from a quantised circle instead of cos/sin per particle
+const int angleSteps = 1024;
+
+struct AngleTable {
+    float cosines[angleSteps];
+    float sines[angleSteps];
+
+    AngleTable() {
+        for (int i = 0; i < angleSteps; ++i) {
+            float angle = 6.2831853f * i / angleSteps;
+            cosines[i] = cos(angle);
+            sines[i] = sin(angle);
+        }
+    }
+};
+
+static const AngleTable& angleTable() {
+    static const AngleTable table;
+    return table;
+}
+
+void swirlParticles(const glm::vec3* positions, int count, Xoshiro128Plus& rng, Particle* out) {
+    const AngleTable& table = angleTable();
+
+    // Four uniforms per particle: angle, speed, z offset, size
+    const int batch = 256;
+    float random[batch * 4];
+
+    for (int first = 0; first < count; first += batch) {
+        int n = std::min(batch, count - first);
+        rng.fillUniform(random, n * 4);
+
+        for (int i = 0; i < n; ++i) {
+            const float* r = random + i * 4;
+            int step = int(r[0] * angleSteps);
+            float speed = 0.5f + r[1] * 1.5f;
+            float zOffset = (r[2] - 0.5f) * 0.4f;
+
+            glm::vec3 swirlVel = glm::vec3(table.cosines[step], table.sines[step], zOffset) * speed;
+            float size = 0.02f + r[3] * 0.05f;
+            out[first + i] = { positions[first + i], swirlVel, 1.0f, size };
+        }
+    }
+}
+
+void ParticlePool::emit(const glm::vec3* positions, int requested, Xoshiro128Plus& rng) {
+    const int spawned = std::min(requested, capacity - count);
+
+    // Made a batch at a time, which draws the random numbers as one call would
+    const int batch = 256;
+    Particle made[batch];
+    for (int first = 0; first < spawned; first += batch) {
+        int n = std::min(batch, spawned - first);
+        swirlParticles(positions + first, n, rng, made);
+        for (int i = 0; i < n; ++i)
+            spawn(made[i].position, made[i].velocity, made[i].size);
+    }
+}
@@ -0,0 +1,44 @@
+#pragma once
+#include <vector>
+#include <glm/glm.hpp>
+#include "random.h"
+
+// The CPU side of the particle simulation, kept free of GL so it can be
+// benchmarked without a context (see particles.h for the GPU side)
+
+// GPU buffer layout of one particle
+struct Particle {
+    glm::vec3 position;
+    glm::vec3 velocity;
+    float life;
+    float size;
+};
+
+// Fills out with a new particle at each position, with a random swirl
+// velocity and size; random numbers are drawn in batches, not per particle
+void swirlParticles(const glm::vec3* positions, int count, Xoshiro128Plus& rng, Particle* out);
+
+// Fixed-capacity structure-of-arrays particle store for CPU simulation.
+// Everything is allocated up front; dead particles are removed by moving the
+// last live one into their slot, so live particles stay packed at the front.
+class ParticlePool {
+public:
+    explicit ParticlePool(int capacity);
+
+    bool spawn(const glm::vec3& position, const glm::vec3& velocity, float size);
+    // swirlParticles() at each position, as many as there is room for
+    void emit(const glm::vec3* positions, int requested, Xoshiro128Plus& rng);
+    void update(float deltaTime);
+
+    // Interleaves the live particles into dst, which holds size() particles
+    void pack(Particle* dst) const;
+
+    int size() const { return count; }
+
+private:
+    int capacity;
+    int count = 0;
+    std::vector<float> px, py, pz;
+    std::vector<float> vx, vy, vz;
+    std::vector<float> life, sizes;
+};
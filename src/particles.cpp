@@ -1,60 +1,182 @@
 #include "particles.h"
 #include <algorithm>
-#include <GL/gl.h> 
-#include <cstdlib>
+#include <cstddef>
 #include <cmath>
+#include "shaders.h"
+#include "stream_buffer.h"
 
-ParticleSystem::ParticleSystem(int maxParticles)
-    : maxParticles(maxParticles) {}
+ParticleSystem::ParticleSystem(int maxParticles, ParticleSimulation simulation, uint64_t seed)
+    : simulation(simulation),
+      pool(simulation == ParticleSimulation::Cpu ? maxParticles : 0),
+      rng(seed),
+      maxParticles(maxParticles) {
+    if (simulation == ParticleSimulation::Gpu)
+        pending.reserve(maxParticles);
+}
 
-void ParticleSystem::emit(const glm::vec3& position, const glm::vec3& velocity) {
-    if (particles.size() < maxParticles) {
-        float angle = static_cast<float>(rand()) / RAND_MAX * 6.28f;
-        float speed = 0.5f + static_cast<float>(rand()) / RAND_MAX * 1.5f;
-        float zOffset = (static_cast<float>(rand()) / RAND_MAX - 0.5f) * 0.4f;
+static void setupParticleAttributes() {
+    glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, sizeof(Particle), (void*)offsetof(Particle, position));
+    glEnableVertexAttribArray(0);
+    glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, sizeof(Particle), (void*)offsetof(Particle, velocity));
+    glEnableVertexAttribArray(1);
+    glVertexAttribPointer(2, 1, GL_FLOAT, GL_FALSE, sizeof(Particle), (void*)offsetof(Particle, life));
+    glEnableVertexAttribArray(2);
+    glVertexAttribPointer(3, 1, GL_FLOAT, GL_FALSE, sizeof(Particle), (void*)offsetof(Particle, size));
+    glEnableVertexAttribArray(3);
+}
 
-        glm::vec3 swirlVel = glm::vec3(cos(angle), sin(angle), zOffset) * speed;
-        float size = 0.02f + static_cast<float>(rand()) / RAND_MAX * 0.05f;
+void ParticleSystem::setupBuffers() {
+    deltaTimeUniform = particleUpdateProgram.uniform("deltaTime");
+    viewportHeightUniform = particleProgram.uniform("viewportHeight");
+    behindUniform = particleProgram.uniform("behind");
 
-        particles.push_back({ position, swirlVel, 1.0f, size });
+    // CPU particles are drawn straight out of the stream buffer; slices are
+    // particle-aligned, so the draw just starts at the slice's first particle
+    if (simulation == ParticleSimulation::Cpu) {
+        glGenVertexArrays(1, vao);
+        glBindVertexArray(vao[0]);
+        glBindBuffer(GL_ARRAY_BUFFER, streamBuffer.id());
+        setupParticleAttributes();
+        glBindBuffer(GL_ARRAY_BUFFER, 0);
+        glBindVertexArray(0);
+        return;
     }
+
+    std::vector<Particle> dead(maxParticles, Particle{glm::vec3(0.0f), glm::vec3(0.0f), 0.0f, 0.0f});
+
+    glGenVertexArrays(2, vao);
+    glGenBuffers(2, vbo);
+    for (int i = 0; i < 2; ++i) {
+        glBindVertexArray(vao[i]);
+        glBindBuffer(GL_ARRAY_BUFFER, vbo[i]);
+        glBufferData(GL_ARRAY_BUFFER, maxParticles * sizeof(Particle), dead.data(), GL_DYNAMIC_COPY);
+        setupParticleAttributes();
+    }
+    glBindBuffer(GL_ARRAY_BUFFER, 0);
+    glBindVertexArray(0);
 }
 
-void ParticleSystem::update(float deltaTime) {
-    for (auto& p : particles) {
-        // Spiral motion
-        glm::vec3 radial = glm::normalize(glm::vec3(-p.position.y, p.position.x, 0.0f));
-        p.velocity += radial * 0.2f * deltaTime;
+void ParticleSystem::emit(const glm::vec3* positions, int count) {
+    if (simulation == ParticleSimulation::Cpu) {
+        pool.emit(positions, count, rng);
+    } else {
+        count = std::min(count, maxParticles - (int)pending.size());
+        if (count <= 0)
+            return;
+        size_t first = pending.size();
+        pending.resize(first + count);
+        swirlParticles(positions, count, rng, pending.data() + first);
+    }
+    if (count > 0)
+        packedOffset = -1;
+}
+
+// Every particle loses life at the same rate, so the slot after the last one
+// written is always the oldest and new particles simply overwrite the ring.
+// The batch is staged in the stream buffer and copied on the GPU, so the
+// CPU never waits for the transform feedback pass still reading the ring.
+void ParticleSystem::uploadPending() {
+    int count = (int)pending.size();
+    int first = std::min(count, maxParticles - writeCursor);
 
-        p.position += p.velocity * deltaTime;
-        p.life -= deltaTime * 0.5f;
+    GLintptr staged = streamBuffer.upload(pending.data(), count * sizeof(Particle), sizeof(Particle));
+    if (staged >= 0) {
+        glBindBuffer(GL_COPY_READ_BUFFER, streamBuffer.id());
+        glBindBuffer(GL_COPY_WRITE_BUFFER, vbo[current]);
+        glCopyBufferSubData(GL_COPY_READ_BUFFER, GL_COPY_WRITE_BUFFER, staged,
+                            writeCursor * sizeof(Particle), first * sizeof(Particle));
+        if (count > first)
+            glCopyBufferSubData(GL_COPY_READ_BUFFER, GL_COPY_WRITE_BUFFER, staged + first * sizeof(Particle),
+                                0, (count - first) * sizeof(Particle));
+        glBindBuffer(GL_COPY_READ_BUFFER, 0);
+        glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
     }
 
-    particles.erase(std::remove_if(particles.begin(), particles.end(),
-                                   [](const Particle& p) { return p.life <= 0.0f; }),
-                    particles.end());
+    writeCursor = (writeCursor + count) % maxParticles;
+    pending.clear();
 }
 
-void ParticleSystem::render() {
+void ParticleSystem::update(float deltaTime) {
+    if (simulation == ParticleSimulation::Cpu) {
+        pool.update(deltaTime);
+        packedOffset = -1;
+        return;
+    }
+
+    if (!vao[0])
+        return;
+    if (!pending.empty())
+        uploadPending();
+
+    int next = 1 - current;
+
+    particleUpdateProgram.use();
+    particleUpdateProgram.set(deltaTimeUniform, deltaTime);
+
+    glEnable(GL_RASTERIZER_DISCARD);
+    glBindVertexArray(vao[current]);
+    glBindBufferBase(GL_TRANSFORM_FEEDBACK_BUFFER, 0, vbo[next]);
+    glBeginTransformFeedback(GL_POINTS);
+    glDrawArrays(GL_POINTS, 0, maxParticles);
+    glEndTransformFeedback();
+    glBindBufferBase(GL_TRANSFORM_FEEDBACK_BUFFER, 0, 0);
+    glBindVertexArray(0);
+    glDisable(GL_RASTERIZER_DISCARD);
+
+    current = next;
+}
+
+void ParticleSystem::render(float viewportHeight, float behind) {
+    if (!vao[0])
+        return;
+
+    // CPU-simulated particles are packed straight into mapped memory and
+    // only the live ones are drawn
+    int firstParticle = 0;
+    int drawCount = maxParticles;
+    if (simulation == ParticleSimulation::Cpu) {
+        drawCount = pool.size();
+        if (drawCount == 0)
+            return;
+
+        if (packedOffset < 0 || packedFrame != streamBuffer.frameNumber()) {
+            Particle* dst = (Particle*)streamBuffer.map(drawCount * sizeof(Particle), sizeof(Particle), packedOffset);
+            if (!dst) {
+                packedOffset = -1;
+                return;
+            }
+            pool.pack(dst);
+            streamBuffer.unmap();
+            packedFrame = streamBuffer.frameNumber();
+        }
+        firstParticle = int(packedOffset / sizeof(Particle));
+    }
+
     glEnable(GL_BLEND);
     glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
+    glEnable(GL_PROGRAM_POINT_SIZE);
+    glDepthMask(GL_FALSE);
 
-    // Glow layer
-    glPointSize(3.0f);
-    glBegin(GL_POINTS);
-    for (const auto& p : particles) {
-        glColor4f(1.0f, 1.0f, 0.4f, p.life * 0.1f);
-        glVertex3f(p.position.x, p.position.y, p.position.z);
-    }
-    glEnd();
+    particleProgram.use();
+    particleProgram.set(viewportHeightUniform, viewportHeight);
+    particleProgram.set(behindUniform, behind);
+
+    // Their glow comes from the bloom pass over the whole scene
+    glBindVertexArray(vao[current]);
+    glDrawArrays(GL_POINTS, firstParticle, drawCount);
 
-    // Main particle layer
-    glPointSize(2.0f);
-    glBegin(GL_POINTS);
-    for (const auto& p : particles) {
-        float hue = p.life;
-        glColor4f(1.0f * hue, 0.8f * hue, 0.2f, p.life);
-        glVertex3f(p.position.x, p.position.y, p.position.z);
+    glBindVertexArray(0);
+    glDepthMask(GL_TRUE);
+    glDisable(GL_BLEND);
+}
+
+void ParticleSystem::cleanup() {
+    if (vao[0]) {
+        glDeleteVertexArrays(2, vao);
+        vao[0] = vao[1] = 0;
+    }
+    if (vbo[0]) {
+        glDeleteBuffers(2, vbo);
+        vbo[0] = vbo[1] = 0;
     }
-    glEnd();
 }
@@ -1,24 +1,56 @@
 #pragma once
 #include <vector>
+#include <glad/glad.h>
 #include <glm/glm.hpp>
+#include "particle_pool.h"
+#include "random.h"
 
-struct Particle {
-    glm::vec3 position;
-    glm::vec3 velocity;
-    float life;
-    float size;
-};
+enum class ParticleSimulation { Gpu, Cpu };
 
+// Particles live in a pair of GPU buffers and are advanced with transform
+// feedback, ping-ponging between them each update. New particles are staged
+// on the CPU and written over the oldest slots of the ring once per update.
+// Staged particles reach the ring through the stream buffer and a GPU copy.
+// With ParticleSimulation::Cpu the simulation runs in a ParticlePool instead
+// and the live particles are packed straight into the stream buffer for
+// drawing; that mode needs no GL context until render().
 class ParticleSystem {
 public:
-    ParticleSystem(int maxParticles);
+    ParticleSystem(int maxParticles, ParticleSimulation simulation = ParticleSimulation::Gpu,
+                   uint64_t seed = 0x5EEDCA7105E1ULL);
 
-    void emit(const glm::vec3& position, const glm::vec3& velocity);
+    // Needs a current GL context and linked programs; call once before the first update
+    void setupBuffers();
+    // Spawns one particle at each position with a random swirl velocity;
+    // random numbers for the whole burst are drawn in one pass
+    void emit(const glm::vec3* positions, int count);
+    void reseed(uint64_t seed) { rng.reseed(seed); }
     void update(float deltaTime);
-    void render();
-    
+    // View and projection come from the FrameUniforms buffer. Particles
+    // are drawn where they were `behind` seconds before the last update.
+    void render(float viewportHeight, float behind = 0.0f);
+    void cleanup();
+
+    // Particles alive in the CPU simulation; the GPU ring does not track this
+    int liveParticles() const { return pool.size(); }
+
 private:
-    std::vector<Particle> particles;
+    void uploadPending();
+
+    ParticleSimulation simulation;
+    ParticlePool pool;
+    Xoshiro128Plus rng;
+    std::vector<Particle> pending;
     int maxParticles;
+    int writeCursor = 0;
+    int current = 0;
+    GLuint vao[2] = {0, 0};
+    GLuint vbo[2] = {0, 0};
+    int deltaTimeUniform = -1;
+    int viewportHeightUniform = -1;
+    int behindUniform = -1;
+    // CPU particles packed into the stream buffer, reused by every view
+    // drawn before the next update or frame
+    GLintptr packedOffset = -1;
+    unsigned long long packedFrame = 0;
 };
-
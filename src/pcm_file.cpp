@@ -0,0 +1,201 @@
+#include "pcm_file.h"
+#include <algorithm>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <vector>
+#include <fcntl.h>
+#include <strings.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include "decoder.h"
+
+// .pcm layout: this header, then lengthFrames * channels int16 samples.
+// The source's size and modification time are stored so a cache for a
+// file that has since changed is rejected instead of played.
+struct PcmHeader {
+    char magic[8];
+    uint32_t channels;
+    uint32_t sampleRate;
+    int64_t lengthFrames;
+    int64_t sourceSize;
+    int64_t sourceTime;
+};
+
+static const char pcmMagic[8] = { 'C', 'R', 'S', 'L', 'P', 'C', 'M', '1' };
+
+static_assert(sizeof(PcmHeader) == 40, "PcmHeader is written to disk as is");
+
+MappedPcm::~MappedPcm() {
+    close();
+}
+
+bool MappedPcm::map(const char* path) {
+    close();
+
+    int fd = ::open(path, O_RDONLY);
+    if (fd < 0)
+        return false;
+
+    struct stat info;
+    if (fstat(fd, &info) != 0 || info.st_size <= 0) {
+        ::close(fd);
+        return false;
+    }
+
+    void* data = mmap(nullptr, size_t(info.st_size), PROT_READ, MAP_PRIVATE, fd, 0);
+    ::close(fd);  // the mapping keeps the file alive
+    if (data == MAP_FAILED)
+        return false;
+
+    // Playback walks forward; let the kernel read ahead
+    madvise(data, size_t(info.st_size), MADV_SEQUENTIAL);
+
+    mapping = data;
+    mappingSize = size_t(info.st_size);
+    return true;
+}
+
+void MappedPcm::close() {
+    if (mapping)
+        munmap(mapping, mappingSize);
+    mapping = nullptr;
+    mappingSize = 0;
+    samples = nullptr;
+    channels = sampleRate = 0;
+    lengthFrames = 0;
+}
+
+static uint32_t readLE32(const unsigned char* p) {
+    return p[0] | (p[1] << 8) | (p[2] << 16) | (uint32_t(p[3]) << 24);
+}
+
+static uint16_t readLE16(const unsigned char* p) {
+    return uint16_t(p[0] | (p[1] << 8));
+}
+
+bool MappedPcm::parseWav() {
+    const unsigned char* bytes = (const unsigned char*)mapping;
+    if (mappingSize < 12 || memcmp(bytes, "RIFF", 4) != 0 || memcmp(bytes + 8, "WAVE", 4) != 0)
+        return false;
+
+    int format = 0, bits = 0;
+    for (size_t pos = 12; pos + 8 <= mappingSize;) {
+        const unsigned char* chunk = bytes + pos;
+        size_t size = std::min<size_t>(readLE32(chunk + 4), mappingSize - pos - 8);
+        if (memcmp(chunk, "fmt ", 4) == 0 && size >= 16) {
+            format = readLE16(chunk + 8);
+            channels = readLE16(chunk + 10);
+            sampleRate = (int)readLE32(chunk + 12);
+            bits = readLE16(chunk + 22);
+        } else if (memcmp(chunk, "data", 4) == 0) {
+            // Samples are read in place, so they must be 2-byte aligned
+            if (format != 1 || bits != 16 || channels < 1 || channels > 2 || sampleRate <= 0 || (pos & 1))
+                return false;
+            samples = (const short*)(chunk + 8);
+            lengthFrames = (long long)(size / (2 * channels));
+            return lengthFrames > 0;
+        }
+        pos += 8 + size + (size & 1);
+    }
+    return false;
+}
+
+// sourceSize < 0 skips the staleness check
+bool MappedPcm::parsePcm(long long sourceSize, long long sourceTime) {
+    if (mappingSize < sizeof(PcmHeader))
+        return false;
+
+    PcmHeader header;
+    memcpy(&header, mapping, sizeof(header));
+    if (memcmp(header.magic, pcmMagic, sizeof(pcmMagic)) != 0)
+        return false;
+    if (sourceSize >= 0 && (header.sourceSize != sourceSize || header.sourceTime != sourceTime))
+        return false;
+    if (header.channels < 1 || header.channels > 2 || header.sampleRate == 0 || header.lengthFrames <= 0)
+        return false;
+    if ((mappingSize - sizeof(PcmHeader)) / (2 * header.channels) < (size_t)header.lengthFrames)
+        return false;
+
+    channels = (int)header.channels;
+    sampleRate = (int)header.sampleRate;
+    lengthFrames = header.lengthFrames;
+    samples = (const short*)((const char*)mapping + sizeof(PcmHeader));
+    return true;
+}
+
+bool MappedPcm::open(const char* path) {
+    if (!map(path))
+        return false;
+    if (parseWav() || parsePcm(-1, 0))
+        return true;
+    close();
+    return false;
+}
+
+bool MappedPcm::openCache(const char* sourcePath) {
+    struct stat source;
+    if (stat(sourcePath, &source) != 0)
+        return false;
+    if (!map(pcmCachePath(sourcePath).c_str()))
+        return false;
+    if (parsePcm(source.st_size, source.st_mtime))
+        return true;
+    close();
+    return false;
+}
+
+std::string pcmCachePath(const char* sourcePath) {
+    return std::string(sourcePath) + ".pcm";
+}
+
+bool isPcmFile(const char* path) {
+    size_t length = strlen(path);
+    return length > 4 && (strcasecmp(path + length - 4, ".wav") == 0 || strcasecmp(path + length - 4, ".pcm") == 0);
+}
+
+bool writePcmCache(const std::string& sourcePath, const std::atomic<bool>& abort) {
+    struct stat source;
+    if (stat(sourcePath.c_str(), &source) != 0)
+        return false;
+
+    VorbisStream stream;
+    if (!stream.open(sourcePath.c_str()))
+        return false;
+
+    const std::string cachePath = pcmCachePath(sourcePath.c_str());
+    const std::string tempPath = cachePath + ".tmp";
+    FILE* out = fopen(tempPath.c_str(), "wb");
+    if (!out)
+        return false;  // read-only asset directory; playback just decodes every time
+
+    PcmHeader header = {};
+    memcpy(header.magic, pcmMagic, sizeof(pcmMagic));
+    header.channels = uint32_t(stream.channels);
+    header.sampleRate = uint32_t(stream.sampleRate);
+    header.sourceSize = source.st_size;
+    header.sourceTime = source.st_mtime;
+    bool ok = fwrite(&header, sizeof(header), 1, out) == 1;
+
+    const int chunkFrames = 1 << 14;
+    std::vector<short> chunk(size_t(chunkFrames) * stream.channels);
+    long long frames = 0;
+    int n;
+    while (ok && !abort.load(std::memory_order_relaxed) && (n = stream.read(chunk.data(), chunkFrames)) > 0) {
+        ok = fwrite(chunk.data(), sizeof(short) * stream.channels, n, out) == size_t(n);
+        frames += n;
+    }
+
+    // The frame count is only known at the end; it goes in last
+    header.lengthFrames = frames;
+    ok = ok && !abort.load(std::memory_order_relaxed) && frames > 0 &&
+         fseek(out, 0, SEEK_SET) == 0 && fwrite(&header, sizeof(header), 1, out) == 1;
+    ok = fclose(out) == 0 && ok;
+
+    if (!ok || rename(tempPath.c_str(), cachePath.c_str()) != 0) {
+        unlink(tempPath.c_str());
+        return false;
+    }
+    return true;
+}
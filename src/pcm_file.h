@@ -0,0 +1,54 @@
+#ifndef PCM_FILE_H
+#define PCM_FILE_H
+
+#include <atomic>
+#include <string>
+
+// Read-only memory mapping of 16-bit interleaved PCM, either a WAV file or
+// a Carousel .pcm file (a small header followed by the samples). Nothing is
+// copied: frames() points into the mapping and the kernel pages the data in
+// as playback and analysis touch it. Little-endian hosts only, like the
+// formats themselves.
+class MappedPcm {
+public:
+    ~MappedPcm();
+
+    MappedPcm() = default;
+    MappedPcm(const MappedPcm&) = delete;
+    MappedPcm& operator=(const MappedPcm&) = delete;
+
+    // .wav or .pcm, chosen by the file's own header
+    bool open(const char* path);
+    // The decode cache written by writePcmCache(); fails if the source
+    // has changed since the cache was written
+    bool openCache(const char* sourcePath);
+    void close();
+
+    bool isOpen() const { return samples != nullptr; }
+    const short* frames() const { return samples; }
+
+    int channels = 0;
+    int sampleRate = 0;
+    long long lengthFrames = 0;
+
+private:
+    bool map(const char* path);
+    bool parseWav();
+    bool parsePcm(long long sourceSize, long long sourceTime);
+
+    void* mapping = nullptr;
+    size_t mappingSize = 0;
+    const short* samples = nullptr;
+};
+
+// Where the decode cache for a compressed file lives: next to it, as FILE.pcm
+std::string pcmCachePath(const char* sourcePath);
+
+bool isPcmFile(const char* path);
+
+// Decodes an Ogg Vorbis file in full into its .pcm cache. Written to a
+// temporary file and renamed at the end, so an aborted or failed run never
+// leaves a partial cache behind. Meant for a background thread.
+bool writePcmCache(const std::string& sourcePath, const std::atomic<bool>& abort);
+
+#endif
@@ -0,0 +1,382 @@
+#include "profiler.h"
+#include <glad/glad.h>
+#include <GLFW/glfw3.h>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <iostream>
+#include <mutex>
+#include <string>
+#include <vector>
+#include "scene_target.h"
+#include "shaders.h"
+#include "stream_buffer.h"
+
+extern GLFWwindow* window;
+
+// Times are microseconds since initProfiler(), as Chrome traces expect
+struct TraceEvent {
+    const char* name;
+    double start;
+    double duration;
+    int thread;
+};
+
+static bool enabled = false;
+static std::chrono::steady_clock::time_point epoch;
+
+// Shared by the render and analysis threads. Past the cap (about 32 MB)
+// events are counted but dropped, so a long session cannot exhaust memory.
+const size_t maxTraceEvents = 1 << 20;
+static std::mutex traceMutex;
+static std::vector<TraceEvent> traceEvents;
+static std::vector<std::pair<int, std::string>> threadNames;
+static size_t droppedEvents = 0;
+
+static std::atomic<int> nextThreadId{1};
+static thread_local int threadId = 0;
+
+// GPU results get their own row in the trace
+const int gpuThreadId = 1000;
+
+const int gpuPassCount = (int)GpuPass::Count;
+static const char* gpuPassNames[gpuPassCount] = { "gpu simulation", "gpu base", "gpu bars", "gpu particles", "gpu bloom" };
+
+// Two query sets: frame N issues into set N & 1 and, before that, reads back
+// what the same set measured in frame N - 2, which has finished by then.
+// A result that is somehow still pending is skipped rather than waited on.
+static GLuint gpuQueries[2][gpuPassCount];
+static bool gpuIssued[2][gpuPassCount];
+static double gpuSubmitted[2][gpuPassCount];
+static int querySet = 0;
+static int activePass = -1;
+static float gpuPassMillis[gpuPassCount];
+
+// Last historyFrames frame times for the graph and the rolling percentiles
+const int historyFrames = 240;
+static float frameHistory[historyFrames];
+static int historyCursor = 0;
+static int historyCount = 0;
+
+// Whole-run histogram in 0.1 ms buckets, the last one catching everything above
+const int histogramBuckets = 1000;
+const float histogramBucketMillis = 0.1f;
+static long long frameHistogram[histogramBuckets];
+static long long framesRecorded = 0;
+static float slowestFrame = 0.0f;
+
+static double frameStart = 0.0;
+static double lastFrameEnd = -1.0;
+static int framesSinceTitle = 0;
+
+static GLuint overlayVAO;
+static std::vector<float> overlayVertices;
+
+static double nowMicros() {
+    return std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - epoch).count();
+}
+
+static int currentThread() {
+    if (threadId == 0)
+        threadId = nextThreadId++;
+    return threadId;
+}
+
+static void record(const char* name, double start, double duration, int thread) {
+    std::lock_guard<std::mutex> lock(traceMutex);
+    if (traceEvents.size() < maxTraceEvents)
+        traceEvents.push_back({ name, start, duration, thread });
+    else
+        ++droppedEvents;
+}
+
+void initProfiler(bool enable) {
+    enabled = enable;
+    if (!enabled)
+        return;
+
+    epoch = std::chrono::steady_clock::now();
+    traceEvents.reserve(1 << 16);
+    setProfilerThreadName("main");
+    {
+        std::lock_guard<std::mutex> lock(traceMutex);
+        threadNames.push_back({ gpuThreadId, "GPU" });
+    }
+
+    glGenQueries(2 * gpuPassCount, &gpuQueries[0][0]);
+
+    // Attributes are pointed at each frame's vertices in the stream buffer
+    glGenVertexArrays(1, &overlayVAO);
+    glBindVertexArray(overlayVAO);
+    glEnableVertexAttribArray(0);
+    glEnableVertexAttribArray(1);
+    glBindVertexArray(0);
+}
+
+bool profilerEnabled() {
+    return enabled;
+}
+
+void shutdownProfiler() {
+    if (!enabled)
+        return;
+
+    glDeleteQueries(2 * gpuPassCount, &gpuQueries[0][0]);
+    if (overlayVAO) {
+        glDeleteVertexArrays(1, &overlayVAO);
+        overlayVAO = 0;
+    }
+}
+
+void setProfilerThreadName(const char* name) {
+    if (!enabled)
+        return;
+    int thread = currentThread();
+    std::lock_guard<std::mutex> lock(traceMutex);
+    threadNames.push_back({ thread, name });
+}
+
+ProfileScope::ProfileScope(const char* name) : name(name), start(enabled ? nowMicros() : 0.0) {}
+
+ProfileScope::~ProfileScope() {
+    if (enabled)
+        record(name, start, nowMicros() - start, currentThread());
+}
+
+// With several outputs a pass runs once per view; only the first is timed
+void beginGpuPass(GpuPass pass) {
+    if (!enabled || activePass >= 0 || gpuIssued[querySet][(int)pass])
+        return;
+    activePass = (int)pass;
+    gpuSubmitted[querySet][activePass] = nowMicros();
+    glBeginQuery(GL_TIME_ELAPSED, gpuQueries[querySet][activePass]);
+}
+
+void endGpuPass() {
+    if (!enabled || activePass < 0)
+        return;
+    glEndQuery(GL_TIME_ELAPSED);
+    gpuIssued[querySet][activePass] = true;
+    activePass = -1;
+}
+
+// Collects what the current query set measured two frames ago
+static void collectGpuQueries() {
+    for (int pass = 0; pass < gpuPassCount; ++pass) {
+        if (!gpuIssued[querySet][pass])
+            continue;
+        gpuIssued[querySet][pass] = false;
+
+        GLuint query = gpuQueries[querySet][pass];
+        GLint available = 0;
+        glGetQueryObjectiv(query, GL_QUERY_RESULT_AVAILABLE, &available);
+        if (!available)
+            continue;
+
+        GLuint64 nanoseconds = 0;
+        glGetQueryObjectui64v(query, GL_QUERY_RESULT, &nanoseconds);
+        gpuPassMillis[pass] = float(nanoseconds / 1.0e6);
+
+        // Placed at submission time; the GPU ran it somewhat later
+        record(gpuPassNames[pass], gpuSubmitted[querySet][pass], nanoseconds / 1.0e3, gpuThreadId);
+    }
+}
+
+void beginProfilerFrame() {
+    if (!enabled)
+        return;
+    frameStart = nowMicros();
+    collectGpuQueries();
+}
+
+static float percentile(std::vector<float>& values, float fraction) {
+    if (values.empty())
+        return 0.0f;
+    size_t index = std::min(values.size() - 1, size_t(fraction * values.size()));
+    std::nth_element(values.begin(), values.begin() + index, values.end());
+    return values[index];
+}
+
+static void updateWindowTitle() {
+    std::vector<float> recent(frameHistory, frameHistory + historyCount);
+    float p50 = percentile(recent, 0.50f);
+    float p99 = percentile(recent, 0.99f);
+
+    // Every pass, named as in the trace without the "gpu " each name starts with
+    char passes[192] = "gpu";
+    size_t length = strlen(passes);
+    for (int pass = 0; pass < gpuPassCount && length < sizeof(passes); ++pass)
+        length += snprintf(passes + length, sizeof(passes) - length, " %s %.2f", gpuPassNames[pass] + 4,
+                           gpuPassMillis[pass]);
+
+    char title[320];
+    snprintf(title, sizeof(title), "Carousel | frame p50 %.2f ms p99 %.2f ms | %s ms | scale %.2f",
+             p50, p99, passes, sceneScale());
+    glfwSetWindowTitle(window, title);
+}
+
+void endProfilerFrame() {
+    if (!enabled)
+        return;
+
+    double now = nowMicros();
+    record("frame", frameStart, now - frameStart, currentThread());
+
+    // Frame time is end to end, so time spent outside the bracket still counts
+    if (lastFrameEnd >= 0.0) {
+        float millis = float((now - lastFrameEnd) / 1000.0);
+        frameHistory[historyCursor] = millis;
+        historyCursor = (historyCursor + 1) % historyFrames;
+        historyCount = std::min(historyCount + 1, historyFrames);
+
+        int bucket = std::min(int(millis / histogramBucketMillis), histogramBuckets - 1);
+        ++frameHistogram[bucket];
+        ++framesRecorded;
+        slowestFrame = std::max(slowestFrame, millis);
+    }
+    lastFrameEnd = now;
+
+    // The title is a cheap place for the numbers; refreshing it every frame is not
+    if (window && ++framesSinceTitle >= 30) {
+        framesSinceTitle = 0;
+        updateWindowTitle();
+    }
+
+    querySet ^= 1;
+}
+
+static void pushQuad(float x0, float y0, float x1, float y1, float r, float g, float b) {
+    const float corners[6][2] = { {x0, y0}, {x1, y0}, {x1, y1}, {x0, y0}, {x1, y1}, {x0, y1} };
+    for (const auto& c : corners) {
+        overlayVertices.insert(overlayVertices.end(), { c[0], c[1], r, g, b });
+    }
+}
+
+void renderProfilerOverlay(int viewportWidth, int viewportHeight) {
+    if (!enabled || viewportWidth <= 0 || viewportHeight <= 0)
+        return;
+
+    // Graph layout in pixels; full height is two 60 Hz frames
+    const float margin = 10.0f;
+    const float barWidth = 2.0f;
+    const float graphWidth = historyFrames * barWidth;
+    const float graphHeight = 120.0f;
+    const float graphMillis = 1000.0f / 30.0f;
+    const float budgetMillis = 1000.0f / 60.0f;
+
+    const float sx = 2.0f / viewportWidth;
+    const float sy = 2.0f / viewportHeight;
+    auto px = [&](float x) { return x * sx - 1.0f; };
+    auto py = [&](float y) { return y * sy - 1.0f; };
+
+    overlayVertices.clear();
+    pushQuad(px(margin), py(margin), px(margin + graphWidth), py(margin + graphHeight), 0.05f, 0.05f, 0.05f);
+
+    // Oldest frame on the left, coloured by how far over budget it went
+    for (int i = 0; i < historyCount; ++i) {
+        int index = (historyCursor - historyCount + i + historyFrames) % historyFrames;
+        float millis = frameHistory[index];
+        float height = std::min(millis / graphMillis, 1.0f) * graphHeight;
+        float x = margin + (historyFrames - historyCount + i) * barWidth;
+
+        float r = millis > budgetMillis ? 1.0f : 0.2f;
+        float g = millis > graphMillis ? 0.2f : 0.9f;
+        pushQuad(px(x), py(margin), px(x + barWidth), py(margin + height), r, g, 0.2f);
+    }
+
+    float budgetY = margin + budgetMillis / graphMillis * graphHeight;
+    pushQuad(px(margin), py(budgetY), px(margin + graphWidth), py(budgetY + 1.0f), 0.8f, 0.8f, 0.8f);
+
+    // GPU passes stacked left to right on the same millisecond scale
+    const float passColors[gpuPassCount][3] = { {0.5f, 0.9f, 0.3f}, {0.3f, 0.5f, 1.0f}, {0.2f, 0.9f, 0.9f}, {1.0f, 0.6f, 0.1f}, {0.9f, 0.3f, 0.8f} };
+    float x = margin;
+    for (int pass = 0; pass < gpuPassCount; ++pass) {
+        float width = std::min(gpuPassMillis[pass] / graphMillis, 1.0f) * graphWidth;
+        const float* c = passColors[pass];
+        pushQuad(px(x), py(margin + graphHeight + 4.0f), px(x + width), py(margin + graphHeight + 14.0f), c[0], c[1], c[2]);
+        x += width;
+    }
+
+    glDisable(GL_DEPTH_TEST);
+    glEnable(GL_BLEND);
+    glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
+
+    GLintptr offset = streamBuffer.upload(overlayVertices.data(), overlayVertices.size() * sizeof(float));
+
+    overlayProgram.use();
+    glBindVertexArray(overlayVAO);
+    glBindBuffer(GL_ARRAY_BUFFER, streamBuffer.id());
+    glVertexAttribPointer(0, 2, GL_FLOAT, GL_FALSE, 5 * sizeof(float), (void*)offset);
+    glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, 5 * sizeof(float), (void*)(offset + 2 * sizeof(float)));
+    glBindBuffer(GL_ARRAY_BUFFER, 0);
+    glDrawArrays(GL_TRIANGLES, 0, (GLsizei)(overlayVertices.size() / 5));
+    glBindVertexArray(0);
+
+    glDisable(GL_BLEND);
+    glEnable(GL_DEPTH_TEST);
+}
+
+static float histogramPercentile(float fraction) {
+    long long target = (long long)(fraction * framesRecorded);
+    long long seen = 0;
+    for (int i = 0; i < histogramBuckets; ++i) {
+        seen += frameHistogram[i];
+        if (seen > target)
+            return (i + 1) * histogramBucketMillis;
+    }
+    return histogramBuckets * histogramBucketMillis;
+}
+
+static void writeJsonString(FILE* out, const std::string& text) {
+    fputc('"', out);
+    for (char c : text) {
+        if (c == '"' || c == '\\')
+            fputc('\\', out);
+        fputc(c, out);
+    }
+    fputc('"', out);
+}
+
+bool writeProfileTrace(const char* path) {
+    if (!enabled)
+        return false;
+
+    if (framesRecorded > 0) {
+        std::cerr << "Frames: " << framesRecorded << ", p50 " << histogramPercentile(0.50f) << " ms, p99 "
+                  << histogramPercentile(0.99f) << " ms, worst " << slowestFrame << " ms\n";
+    }
+
+    FILE* out = fopen(path, "w");
+    if (!out) {
+        std::cerr << "Cannot open " << path << " for the profile trace\n";
+        return false;
+    }
+
+    std::lock_guard<std::mutex> lock(traceMutex);
+    fputs("{\"traceEvents\":[\n", out);
+    bool first = true;
+    for (const auto& thread : threadNames) {
+        fprintf(out, "%s{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":%d,\"args\":{\"name\":",
+                first ? "" : ",\n", thread.first);
+        writeJsonString(out, thread.second);
+        fputs("}}", out);
+        first = false;
+    }
+    for (const auto& event : traceEvents) {
+        fprintf(out, "%s{\"name\":", first ? "" : ",\n");
+        writeJsonString(out, event.name);
+        fprintf(out, ",\"ph\":\"X\",\"pid\":1,\"tid\":%d,\"ts\":%.3f,\"dur\":%.3f}",
+                event.thread, event.start, event.duration);
+        first = false;
+    }
+    fputs("\n]}\n", out);
+    fclose(out);
+
+    std::cerr << "Wrote " << traceEvents.size() << " trace events to " << path;
+    if (droppedEvents > 0)
+        std::cerr << " (" << droppedEvents << " dropped)";
+    std::cerr << "\n";
+    return true;
+}
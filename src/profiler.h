@@ -0,0 +1,47 @@
+#ifndef PROFILER_H
+#define PROFILER_H
+
+// Built-in frame profiling, switched on with --profile. While disabled every
+// call below returns immediately, so the instrumentation can stay in place.
+//
+// CPU stages are timed with ProfileScope on whichever thread runs them; GPU
+// passes with GL_TIME_ELAPSED queries that are read back two frames later.
+// Everything recorded ends up in a Chrome trace (chrome://tracing or
+// https://ui.perfetto.dev) written by writeProfileTrace().
+
+enum class GpuPass { Simulation, Base, Bars, Particles, Bloom, Count };
+
+// Needs the GL context current when enabled
+void initProfiler(bool enabled);
+bool profilerEnabled();
+void shutdownProfiler();
+
+// Names the calling thread in the trace
+void setProfilerThreadName(const char* name);
+
+// Times the enclosing block; name must be a string literal
+class ProfileScope {
+public:
+    explicit ProfileScope(const char* name);
+    ~ProfileScope();
+
+private:
+    const char* name;
+    double start;
+};
+
+// GPU passes cannot nest; end one before beginning the next
+void beginGpuPass(GpuPass pass);
+void endGpuPass();
+
+// Brackets one displayed frame, swap included
+void beginProfilerFrame();
+void endProfilerFrame();
+
+// Frame-time graph and GPU pass breakdown in the bottom-left corner
+void renderProfilerOverlay(int viewportWidth, int viewportHeight);
+
+// Also prints a frame-time summary to stderr
+bool writeProfileTrace(const char* path);
+
+#endif
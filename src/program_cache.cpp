@@ -0,0 +1,232 @@
+#include "program_cache.h"
+#include <GLFW/glfw3.h>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <map>
+#include <vector>
+#include <sys/stat.h>
+#include <unistd.h>
+
+// File layout: this header, then per entry a key, binary format and
+// length, followed by the binary itself
+struct CacheHeader {
+    char magic[8];
+    uint32_t entries;
+    uint32_t reserved;
+};
+
+struct EntryHeader {
+    uint64_t key;
+    uint32_t format;
+    uint32_t length;
+};
+
+static const char cacheMagic[8] = { 'C', 'R', 'S', 'L', 'P', 'R', 'G', '1' };
+
+// Far above any real program; a larger length means a damaged file
+const uint32_t maxBinarySize = 64 << 20;
+
+static_assert(sizeof(CacheHeader) == 16 && sizeof(EntryHeader) == 16, "written to disk as is");
+
+struct CachedProgram {
+    GLenum format;
+    std::vector<char> binary;
+    bool used;
+};
+
+static std::map<uint64_t, CachedProgram> programs;
+static std::string cachePath;
+static bool enabled = false;
+static bool changed = false;
+// Vendor, renderer and version, hashed once; every key starts from it
+static uint64_t driverHash;
+
+static uint64_t hashBytes(uint64_t hash, const char* data, size_t size) {
+    for (size_t i = 0; i < size; ++i)
+        hash = (hash ^ (unsigned char)data[i]) * 1099511628211ull;
+    return hash;
+}
+
+// Includes the terminator, so "ab" + "c" and "a" + "bc" differ
+static uint64_t hashString(uint64_t hash, const char* text) {
+    return text ? hashBytes(hash, text, strlen(text) + 1) : hashBytes(hash, "", 1);
+}
+
+std::string defaultProgramCachePath() {
+    const char* xdg = getenv("XDG_CACHE_HOME");
+    const char* home = getenv("HOME");
+    std::string directory;
+    if (xdg && xdg[0])
+        directory = xdg;
+    else if (home && home[0])
+        directory = std::string(home) + "/.cache";
+    else
+        return "";
+    return directory + "/carousel/programs.bin";
+}
+
+// Core in 4.1; older contexts may still have the extension
+static bool loadBinaryFunctions() {
+    if (GLAD_GL_VERSION_4_1)
+        return true;
+    if (!glfwExtensionSupported("GL_ARB_get_program_binary"))
+        return false;
+    glad_glGetProgramBinary = (PFNGLGETPROGRAMBINARYPROC)glfwGetProcAddress("glGetProgramBinary");
+    glad_glProgramBinary = (PFNGLPROGRAMBINARYPROC)glfwGetProcAddress("glProgramBinary");
+    glad_glProgramParameteri = (PFNGLPROGRAMPARAMETERIPROC)glfwGetProcAddress("glProgramParameteri");
+    return glGetProgramBinary && glProgramBinary && glProgramParameteri;
+}
+
+static void readCacheFile() {
+    FILE* file = fopen(cachePath.c_str(), "rb");
+    if (!file)
+        return;
+
+    CacheHeader header;
+    bool ok = fread(&header, sizeof(header), 1, file) == 1 &&
+              memcmp(header.magic, cacheMagic, sizeof(cacheMagic)) == 0;
+    for (uint32_t i = 0; ok && i < header.entries; ++i) {
+        EntryHeader entry;
+        ok = fread(&entry, sizeof(entry), 1, file) == 1 && entry.length <= maxBinarySize;
+        if (!ok)
+            break;
+        CachedProgram& program = programs[entry.key];
+        program.format = entry.format;
+        program.binary.resize(entry.length);
+        program.used = false;
+        ok = fread(program.binary.data(), 1, entry.length, file) == entry.length;
+    }
+    fclose(file);
+
+    // A damaged file is ignored as a whole and rewritten
+    if (!ok) {
+        programs.clear();
+        changed = true;
+    }
+}
+
+void openProgramCache(const std::string& path) {
+    enabled = false;
+    programs.clear();
+    changed = false;
+    if (path.empty() || !loadBinaryFunctions())
+        return;
+
+    GLint formats = 0;
+    glGetIntegerv(GL_NUM_PROGRAM_BINARY_FORMATS, &formats);
+    if (formats <= 0)
+        return;
+
+    driverHash = 14695981039346656037ull;
+    driverHash = hashString(driverHash, (const char*)glGetString(GL_VENDOR));
+    driverHash = hashString(driverHash, (const char*)glGetString(GL_RENDERER));
+    driverHash = hashString(driverHash, (const char*)glGetString(GL_VERSION));
+
+    cachePath = path;
+    enabled = true;
+    readCacheFile();
+}
+
+bool programCacheEnabled() {
+    return enabled;
+}
+
+uint64_t programCacheKey(const char* vertexSource, const char* fragmentSource,
+                         const char* const* feedbackVaryings, int feedbackCount) {
+    uint64_t hash = hashString(driverHash, vertexSource);
+    hash = hashString(hash, fragmentSource);
+    for (int i = 0; i < feedbackCount; ++i)
+        hash = hashString(hash, feedbackVaryings[i]);
+    return hash;
+}
+
+bool loadCachedProgram(GLuint program, uint64_t key) {
+    if (!enabled)
+        return false;
+    auto entry = programs.find(key);
+    if (entry == programs.end())
+        return false;
+
+    entry->second.used = true;
+    glProgramBinary(program, entry->second.format, entry->second.binary.data(), GLsizei(entry->second.binary.size()));
+    return true;
+}
+
+void storeCachedProgram(GLuint program, uint64_t key) {
+    if (!enabled)
+        return;
+
+    GLint length = 0;
+    glGetProgramiv(program, GL_PROGRAM_BINARY_LENGTH, &length);
+    if (length <= 0)
+        return;
+
+    CachedProgram& entry = programs[key];
+    entry.binary.resize(length);
+    GLenum format = 0;
+    glGetProgramBinary(program, length, &length, &format, entry.binary.data());
+    entry.binary.resize(length);
+    entry.format = format;
+    entry.used = true;
+    changed = true;
+}
+
+void forgetCachedProgram(uint64_t key) {
+    if (programs.erase(key))
+        changed = true;
+}
+
+// Creates the parent directory, and ~/.cache above it if need be
+static void makeParentDirectories(const std::string& path) {
+    for (size_t slash = path.find('/', 1); slash != std::string::npos; slash = path.find('/', slash + 1))
+        mkdir(path.substr(0, slash).c_str(), 0755);
+}
+
+// Written to a temporary file and renamed, so a partial cache is never read
+static bool writeCacheFile() {
+    makeParentDirectories(cachePath);
+    const std::string tempPath = cachePath + ".tmp";
+    FILE* out = fopen(tempPath.c_str(), "wb");
+    if (!out)
+        return false;
+
+    CacheHeader header = {};
+    memcpy(header.magic, cacheMagic, sizeof(cacheMagic));
+    for (const auto& entry : programs)
+        header.entries += entry.second.used ? 1 : 0;
+
+    bool ok = fwrite(&header, sizeof(header), 1, out) == 1;
+    for (const auto& entry : programs) {
+        if (!ok)
+            break;
+        if (!entry.second.used)
+            continue;
+        EntryHeader record = { entry.first, uint32_t(entry.second.format), uint32_t(entry.second.binary.size()) };
+        ok = fwrite(&record, sizeof(record), 1, out) == 1 &&
+             fwrite(entry.second.binary.data(), 1, entry.second.binary.size(), out) == entry.second.binary.size();
+    }
+    ok = fclose(out) == 0 && ok;
+
+    if (!ok || rename(tempPath.c_str(), cachePath.c_str()) != 0) {
+        unlink(tempPath.c_str());
+        return false;
+    }
+    return true;
+}
+
+void closeProgramCache() {
+    if (!enabled)
+        return;
+
+    // Entries another build's shaders left behind are dropped as well
+    for (const auto& entry : programs)
+        changed = changed || !entry.second.used;
+    if (changed && !writeCacheFile())
+        std::cerr << "Cannot write program cache " << cachePath << "\n";
+
+    programs.clear();
+    changed = false;
+    enabled = false;
+}
@@ -0,0 +1,36 @@
+#ifndef PROGRAM_CACHE_H
+#define PROGRAM_CACHE_H
+#include <glad/glad.h>
+#include <cstdint>
+#include <string>
+
+// Linked program binaries kept between runs, so later launches skip
+// compiling. Entries are keyed by the program's sources together with the
+// GL vendor, renderer and version strings: after a shader change or a
+// driver update the entry just misses and the program is compiled again.
+
+// ~/.cache/carousel/programs.bin, or under $XDG_CACHE_HOME; empty if neither is set
+std::string defaultProgramCachePath();
+
+// Reads the cache file. Stays disabled if path is empty or the driver
+// cannot hand out program binaries. Needs the GL context current.
+void openProgramCache(const std::string& path);
+bool programCacheEnabled();
+
+// Key for the program built from these sources
+uint64_t programCacheKey(const char* vertexSource, const char* fragmentSource,
+                         const char* const* feedbackVaryings, int feedbackCount);
+
+// Hands the cached binary for key to program; false if there is none.
+// The driver may still reject it, which shows as a failed link.
+bool loadCachedProgram(GLuint program, uint64_t key);
+// Records the binary of a program linked with GL_PROGRAM_BINARY_RETRIEVABLE_HINT
+void storeCachedProgram(GLuint program, uint64_t key);
+// Drops an entry the driver rejected
+void forgetCachedProgram(uint64_t key);
+
+// Rewrites the file if anything was stored or dropped, keeping only the
+// entries used this run, then frees the binaries
+void closeProgramCache();
+
+#endif
@@ -0,0 +1,45 @@
+#pragma once
+#include <cstdint>
+
+// xoshiro128+ (Blackman & Vigna): tiny state, one instance per user, so it is
+// cheap, thread-confined and reproducible for a given seed. The low bits are
+// weak, which is fine here since floats are taken from the top 24 bits.
+class Xoshiro128Plus {
+public:
+    explicit Xoshiro128Plus(uint64_t seed = 0x5EEDCA7105E1ULL) { reseed(seed); }
+
+    void reseed(uint64_t seed) {
+        // Expand the seed with splitmix64 so nearby seeds give unrelated streams
+        for (int i = 0; i < 4; i += 2) {
+            uint64_t z = (seed += 0x9E3779B97F4A7C15ULL);
+            z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+            z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+            z ^= z >> 31;
+            s[i] = uint32_t(z);
+            s[i + 1] = uint32_t(z >> 32);
+        }
+    }
+
+    uint32_t next() {
+        const uint32_t result = s[0] + s[3];
+        const uint32_t t = s[1] << 9;
+        s[2] ^= s[0];
+        s[3] ^= s[1];
+        s[1] ^= s[2];
+        s[0] ^= s[3];
+        s[2] ^= t;
+        s[3] = (s[3] << 11) | (s[3] >> 21);
+        return result;
+    }
+
+    // Uniform in [0, 1)
+    float uniform() { return float(next() >> 8) * (1.0f / 16777216.0f); }
+
+    void fillUniform(float* dst, int count) {
+        for (int i = 0; i < count; ++i)
+            dst[i] = uniform();
+    }
+
+private:
+    uint32_t s[4];
+};
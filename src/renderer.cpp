@@ -1,29 +1,65 @@
 #include "renderer.h"
 #include <glad/glad.h>
 #include <GLFW/glfw3.h>
-#include <kiss_fft.h>
+#include <algorithm>
 #include <iostream>
 #include <cmath>
 #include <vector>
 #include <glm/glm.hpp>
 #include <glm/gtc/matrix_transform.hpp>
-#include <glm/gtc/type_ptr.hpp>
 #include "shaders.h"
 #include "audio.h"
 #include "cleanup.h"
+#include "outputs.h"
 #include "particles.h"
+#include "analysis.h"
+#include "bloom.h"
+#include "capture.h"
+#include "profiler.h"
+#include "scene_target.h"
+#include "stream_buffer.h"
 
-extern GLuint shaderProgram;
 extern GLFWwindow* window;
 
-ParticleSystem particleSystem(1000);
+const int maxParticles = 1 << 17;
+ParticleSimulation particleSimulation = ParticleSimulation::Gpu;
+ParticleSystem* particleSystem;
 
-const int fftSize = 512;
-const int numBars = fftSize / 2;
-GLuint barVAO[numBars], barVBO[numBars];
-float barHeights[numBars] = {0};
+std::vector<float> barHeights;
 
-float bassAmplitude = 1.0f;  
+// One static cube shared by every bar plus a per-instance (angle, height)
+// stream, written to a new slice of the stream buffer every frame
+GLuint barVAO, barMeshVBO;
+std::vector<float> barInstanceData;
+const float barRingRadius = 5.0f;
+
+// Uniform handles, resolved once the programs are linked
+int baseModelUniform = -1;
+int barRingRadiusUniform = -1;
+
+// Driven by the analysis features in applySpectrumFrame()
+float bassAmplitude = 1.0f;
+static unsigned lastOnsetCount = 0;
+// Seen by applySpectrumFrame(), acted on by the next simulation step
+static bool onsetPending = false;
+
+const double simulationStep = 1.0 / 60.0;
+// After a hitch longer than this many steps the rest is dropped, not simulated
+const int maxCatchUpSteps = 15;
+
+// Clock time simulation step 0 was at, moved on by the time dropped after hitches
+static double simulationStart = -1.0;
+static long long stepCount = 0;
+// How far the clock is past the last step, 0..1 of a step; frames are
+// drawn between the last two steps at this fraction
+static float stepFraction = 0.0f;
+
+// Camera state at the last two steps, for interpolation
+struct CameraState {
+    float angle = 0.0f;
+    float kick = 0.0f;
+};
+static CameraState camera, previousCamera;
 
 
 GLuint baseCircleVAO, baseCircleVBO;
@@ -31,9 +67,11 @@ float baseCircleRadius = 5.0f;
 const int circleSegments = 100;
 float baseCircleVertices[(circleSegments + 2) * 3];  // +2 for center and first vertex of the circle
 
-kiss_fft_cfg fftCfg;
-kiss_fft_cpx* fftInput;
-kiss_fft_cpx* fftOutput;
+int viewportWidth = 0;
+int viewportHeight = 0;
+
+SpectrumFrame spectrumFrame;
+std::vector<glm::vec3> emitPositions;
 
 void initOpenGL() {
     if (!gladLoadGLLoader((GLADloadproc)glfwGetProcAddress)) {
@@ -41,14 +79,87 @@ void initOpenGL() {
         exit(-1);
     }
     glEnable(GL_DEPTH_TEST);
-    glViewport(0, 0, 1600, 900);
+
+    // Framebuffer pixels, which differ from window coordinates on high-DPI screens
+    int width, height;
+    glfwGetFramebufferSize(window, &width, &height);
+    setViewportSize(width, height);
+
+    // Sized for a frame that re-uploads every particle, plus room for the rest
+    streamBuffer.create(maxParticles * sizeof(Particle) + (1 << 20));
 }
 
-void setupBars() {
+void setViewportSize(int width, int height) {
+    viewportWidth = width;
+    viewportHeight = height;
+    glViewport(0, 0, width, height);
+}
+
+void setupBarMesh() {
+    const float w = 0.1f;  // width of bar
+    const float d = 0.05f; // depth
+
+    // Unit-height cube; the vertex shader scales y by the instance height
+    const float vertices[] = {
+        // Front face
+        -w, 0.0f,  d,   w, 0.0f,  d,   w, 1.0f, d,
+        -w, 0.0f,  d,   w, 1.0f,  d,  -w, 1.0f, d,
+
+        // Back face
+        -w, 0.0f, -d,  -w, 1.0f, -d,   w, 1.0f, -d,
+        -w, 0.0f, -d,   w, 1.0f, -d,   w, 0.0f, -d,
+
+        // Left face
+        -w, 0.0f,  d,  -w, 1.0f,  d,  -w, 1.0f, -d,
+        -w, 0.0f,  d,  -w, 1.0f, -d,  -w, 0.0f, -d,
+
+        // Right face
+         w, 0.0f,  d,   w, 0.0f, -d,   w, 1.0f, -d,
+         w, 0.0f,  d,   w, 1.0f, -d,   w, 1.0f,  d,
+
+        // Top face
+        -w, 1.0f,  d,   w, 1.0f,  d,   w, 1.0f, -d,
+        -w, 1.0f,  d,   w, 1.0f, -d,  -w, 1.0f, -d,
+
+        // Bottom face
+        -w, 0.0f,  d,  -w, 0.0f, -d,   w, 0.0f, -d,
+        -w, 0.0f,  d,   w, 0.0f, -d,   w, 0.0f,  d
+    };
+
+    const int numBars = analysisConfig.numBars;
+    barHeights.assign(numBars, 0.0f);
+    barInstanceData.assign(numBars * 2, 0.0f);
+    emitPositions.reserve(numBars);
     for (int i = 0; i < numBars; ++i) {
-        glGenVertexArrays(1, &barVAO[i]);
-        glGenBuffers(1, &barVBO[i]);
+        barInstanceData[i * 2] = (2.0f * M_PI / numBars) * i;
+        barInstanceData[i * 2 + 1] = 0.0f;
     }
+
+    barRingRadiusUniform = barProgram.uniform("ringRadius");
+
+    glGenVertexArrays(1, &barVAO);
+    glGenBuffers(1, &barMeshVBO);
+
+    glBindVertexArray(barVAO);
+
+    glBindBuffer(GL_ARRAY_BUFFER, barMeshVBO);
+    glBufferData(GL_ARRAY_BUFFER, sizeof(vertices), vertices, GL_STATIC_DRAW);
+    glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 3 * sizeof(float), (void*)0);
+    glEnableVertexAttribArray(0);
+
+    // Instance attributes are pointed at this frame's slice in renderScene()
+    glEnableVertexAttribArray(1);
+    glVertexAttribDivisor(1, 1);
+    glEnableVertexAttribArray(2);
+    glVertexAttribDivisor(2, 1);
+
+    glBindBuffer(GL_ARRAY_BUFFER, 0);
+    glBindVertexArray(0);
+}
+
+void setupParticles() {
+    particleSystem = new ParticleSystem(maxParticles, particleSimulation);
+    particleSystem->setupBuffers();
 }
 
 void setupBaseCircle() {
@@ -72,6 +183,8 @@ void setupBaseCircle() {
         vertices.push_back(z);
     }
 
+    baseModelUniform = baseProgram.uniform("model");
+
     glGenVertexArrays(1, &baseCircleVAO);
     glGenBuffers(1, &baseCircleVBO);
 
@@ -87,188 +200,185 @@ void setupBaseCircle() {
 }
 
 
+// Picks up the newest analysis result, if any, without waiting for it
+static void applySpectrumFrame() {
+    ProfileScope scope("apply spectrum");
+    if (!latestSpectrumFrame(spectrumFrame))
+        return;
 
-void renderBaseCircle() {
-    glm::mat4 rotation = glm::rotate(glm::mat4(1.0f), (float)glfwGetTime() * 0.5f, glm::vec3(0.0f, 0.0f, 1.0f));
+    // Hops skipped since the last frame may have held the onset, so compare counts
+    const AudioFeatures& features = spectrumFrame.features;
+    bool onset = features.onsetCount != lastOnsetCount;
+    lastOnsetCount = features.onsetCount;
 
-    GLuint transformLoc = glGetUniformLocation(shaderProgram, "model");
-    glUniformMatrix4fv(transformLoc, 1, GL_FALSE, glm::value_ptr(rotation));
+    onsetPending = onsetPending || onset;
 
-    glBindVertexArray(baseCircleVAO);
-    glDrawArrays(GL_TRIANGLE_FAN, 0, 1 + 100 + 1); // center + segments + repeat of first outer vertex
-    glBindVertexArray(0);
+    for (int i = 0; i < analysisConfig.numBars; ++i)
+        barHeights[i] = spectrumFrame.bars[i];
+    bassAmplitude = 1.0f + 0.6f * features.bands[BassBand];
 }
 
-void processAudioFrame() {
-  static float threshold = 1.5f;
-    if (!fftCfg)
-        fftCfg = kiss_fft_alloc(fftSize, 0, nullptr, nullptr);
-
-    if (!fftInput)
-        fftInput = (kiss_fft_cpx*)malloc(sizeof(kiss_fft_cpx) * fftSize);
-    if (!fftOutput)
-        fftOutput = (kiss_fft_cpx*)malloc(sizeof(kiss_fft_cpx) * fftSize);
+// One fixed step of everything that moves on its own: particles are shed
+// and advanced, the camera orbits and its onset kick decays
+static void stepSimulation() {
+    const float step = float(simulationStep);
+    const AudioFeatures& features = spectrumFrame.features;
 
-    if (playbackIndex + fftSize >= audioDataSize)
-        playbackIndex = 0;
+    // Bursts land on onsets; in between only the loudest bars shed particles
+    const float threshold = onsetPending ? 1.0f : 2.25f;
 
-    for (int i = 0; i < fftSize; ++i) {
-        fftInput[i].r = audioData[playbackIndex + i];
-        fftInput[i].i = 0.0f;
+    emitPositions.clear();
+    for (int i = 0; i < analysisConfig.numBars; ++i) {
+        if (barHeights[i] > threshold)
+            emitPositions.push_back(glm::vec3(i * 1.5f, 0.0f, barHeights[i]));
     }
-
-    kiss_fft(fftCfg, fftInput, fftOutput);
-
-	 for (int i = 0; i < numBars; ++i) {
-        float magnitude = sqrt(fftOutput[i].r * fftOutput[i].r + fftOutput[i].i * fftOutput[i].i);
-        barHeights[i] = std::min(magnitude / 5000.0f, 3.0f); 
-          // Emit particles if bar height exceeds threshold
-        if (barHeights[i] > threshold) {
-            glm::vec3 pos = glm::vec3(i * 1.5f, 0.0f, barHeights[i]);  
-            glm::vec3 vel = glm::vec3(0.0f, 1.0f, 0.0f) * barHeights[i] * 0.5f; 
-            particleSystem.emit(pos, vel);
-        }
+    particleSystem->emit(emitPositions.data(), (int)emitPositions.size());
+
+    // The orbit follows the tempo, onsets lift the camera
+    previousCamera = camera;
+    float tempoRate = features.tempo > 0.0f ? features.tempo / 120.0f : 1.0f;
+    camera.angle += step * 0.5f * tempoRate;
+    camera.kick *= std::exp(-4.0f * step);
+    if (onsetPending)
+        camera.kick = std::max(camera.kick, features.onsetStrength);
+    onsetPending = false;
+
+    {
+        ProfileScope particlesScope("particles update");
+        particleSystem->update(step);
     }
+}
 
-
-    playbackIndex += fftSize / 2;
+double displayedCaptureTime() {
+    return spectrumFrame.capturedAt;
 }
 
+void updateScene(double time) {
+    ProfileScope scope("update scene");
+    applySpectrumFrame();
 
+    if (simulationStart < 0.0)
+        simulationStart = time;
+
+    // Whole steps due by now; the epsilon keeps exact multiples, such as
+    // offline frame times, from rounding down a step
+    long long due = (long long)std::floor((time - simulationStart) / simulationStep + 1e-6);
+    if (due - stepCount > maxCatchUpSteps) {
+        simulationStart += double(due - stepCount - maxCatchUpSteps) * simulationStep;
+        due = stepCount + maxCatchUpSteps;
+    }
+    beginGpuPass(GpuPass::Simulation);
+    while (stepCount < due) {
+        stepSimulation();
+        ++stepCount;
+    }
+    endGpuPass();
+
+    double sinceStep = time - simulationStart - double(stepCount) * simulationStep;
+    stepFraction = float(std::clamp(sinceStep / simulationStep, 0.0, 1.0));
+}
+
+void renderScene(float orbitOffset) {
+    ProfileScope scope("render scene");
 
-void renderScene() {
 	glClearColor(0.0f, 0.0f, 0.0f, 0.05f);
     glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
-    glUseProgram(shaderProgram);
+
+    // Drawn a fraction of a step after the previous step, so one step behind the clock
+    const float behind = (1.0f - stepFraction) * float(simulationStep);
+    const double time = simulationStart + double(stepCount) * simulationStep - behind;
+
+    // Sub-bass pulls the camera in
+    const AudioFeatures& features = spectrumFrame.features;
+    float cameraAngle = glm::mix(previousCamera.angle, camera.angle, stepFraction) + orbitOffset;
+    float cameraKick = glm::mix(previousCamera.kick, camera.kick, stepFraction);
+    float cameraRadius = 10.0f - 1.5f * features.bands[SubBand];
 
     // View and Projection matrices
-    float time = glfwGetTime();
-    glm::vec3 camPos = glm::vec3(10.0f * sin(time * 0.5f), 5.0f, 10.0f * cos(time * 0.5f));
+    glm::vec3 camPos = glm::vec3(cameraRadius * sin(cameraAngle), 5.0f + cameraKick, cameraRadius * cos(cameraAngle));
     glm::mat4 view = glm::lookAt(camPos, glm::vec3(0, 0, 0), glm::vec3(0, 1, 0));
-    glm::mat4 projection = glm::perspective(glm::radians(45.0f), 1600.f/900.f, 0.1f, 100.0f);
+    glm::mat4 projection = glm::perspective(glm::radians(45.0f), float(viewportWidth) / viewportHeight, 0.1f, 100.0f);
 
-    GLint modelLoc = glGetUniformLocation(shaderProgram, "model");
-    GLint viewLoc = glGetUniformLocation(shaderProgram, "view");
-    GLint projLoc = glGetUniformLocation(shaderProgram, "projection");
-
-    glUniformMatrix4fv(viewLoc, 1, GL_FALSE, glm::value_ptr(view));
-    glUniformMatrix4fv(projLoc, 1, GL_FALSE, glm::value_ptr(projection));
+    // Shared by every program through the FrameUniforms block
+    FrameUniforms frame = {};
+    frame.view = view;
+    frame.projection = projection;
+    frame.time = float(time);
+    updateFrameUniforms(frame);
 
     // Render the base circle with bass scale
     glm::mat4 model = glm::scale(glm::mat4(1.0f), glm::vec3(bassAmplitude));
-    glUniformMatrix4fv(modelLoc, 1, GL_FALSE, glm::value_ptr(model));
+    beginGpuPass(GpuPass::Base);
+    baseProgram.use();
+    baseProgram.set(baseModelUniform, model);
     glBindVertexArray(baseCircleVAO);
     glDrawArrays(GL_TRIANGLE_FAN, 0, circleSegments + 2);
+    endGpuPass();
 
-    // Render the bars
-    for (int i = 0; i < numBars; ++i) {
-        float angle = (2.0f * M_PI / numBars) * i;
-        float radius = 5.0f;
-        float x = radius * cos(angle);
-        float z = radius * sin(angle);
-        float h = barHeights[i];
-
-        float w = 0.1f; // width of bar
-        float d = 0.05f; // depth
-
-        float vertices[] = {
-            // Front face
-            -w, 0.0f,  d,   w, 0.0f,  d,   w, h, d,
-            -w, 0.0f,  d,   w, h,  d,  -w, h, d,
-
-            // Back face
-            -w, 0.0f, -d,  -w, h, -d,   w, h, -d,
-            -w, 0.0f, -d,   w, h, -d,   w, 0.0f, -d,
+    // Render the bars: refresh the instance heights, then one instanced draw
+    const int numBars = analysisConfig.numBars;
+    for (int i = 0; i < numBars; ++i)
+        barInstanceData[i * 2 + 1] = barHeights[i];
 
-            // Left face
-            -w, 0.0f,  d,  -w, h,  d,  -w, h, -d,
-            -w, 0.0f,  d,  -w, h, -d,  -w, 0.0f, -d,
+    beginGpuPass(GpuPass::Bars);
+    barProgram.use();
+    barProgram.set(barRingRadiusUniform, barRingRadius);
 
-            // Right face
-             w, 0.0f,  d,   w, 0.0f, -d,   w, h, -d,
-             w, 0.0f,  d,   w, h, -d,   w, h,  d,
+    GLintptr instances = streamBuffer.upload(barInstanceData.data(), barInstanceData.size() * sizeof(float));
 
-            // Top face
-            -w, h,  d,   w, h,  d,   w, h, -d,
-            -w, h,  d,   w, h, -d,  -w, h, -d,
-
-            // Bottom face
-            -w, 0.0f,  d,  -w, 0.0f, -d,   w, 0.0f, -d,
-            -w, 0.0f,  d,   w, 0.0f, -d,   w, 0.0f,  d
-        };
-
-        GLuint indices[] = {
-            0, 1, 2, 2, 3, 0, // Front
-            4, 5, 6, 6, 7, 4, // Back
-            0, 3, 5, 5, 4, 0, // Left
-            1, 7, 6, 6, 2, 1, // Right
-            3, 2, 6, 6, 5, 3, // Top
-            0, 4, 7, 7, 1, 0  // Bottom
-        };
-
-        model = glm::mat4(1.0f);
-        model = glm::translate(model, glm::vec3(x, 0.0f, z));
-        model = glm::rotate(model, -angle, glm::vec3(0, 1, 0));
-
-        glUniformMatrix4fv(modelLoc, 1, GL_FALSE, glm::value_ptr(model));
-
-        glBindVertexArray(barVAO[i]);
-        glBindBuffer(GL_ARRAY_BUFFER, barVBO[i]);
-        glBufferData(GL_ARRAY_BUFFER, sizeof(vertices), vertices, GL_DYNAMIC_DRAW);
-
-        glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 3 * sizeof(float), (void*)0);
-        glEnableVertexAttribArray(0);
+    glBindVertexArray(barVAO);
+    glBindBuffer(GL_ARRAY_BUFFER, streamBuffer.id());
+    glVertexAttribPointer(1, 1, GL_FLOAT, GL_FALSE, 2 * sizeof(float), (void*)instances);
+    glVertexAttribPointer(2, 1, GL_FLOAT, GL_FALSE, 2 * sizeof(float), (void*)(instances + sizeof(float)));
+    glBindBuffer(GL_ARRAY_BUFFER, 0);
+    glDrawArraysInstanced(GL_TRIANGLES, 0, 36, numBars);
+    glBindVertexArray(0);
+    endGpuPass();
 
-        glDrawArrays(GL_TRIANGLES, 0, 36);
+    beginGpuPass(GpuPass::Particles);
+    {
+        ProfileScope particlesScope("particles render");
+        particleSystem->render(float(viewportHeight), behind);
     }
-
-static float lastTime = glfwGetTime();
-float currentTime = glfwGetTime();
-float deltaTime = currentTime - lastTime;
-lastTime = currentTime;
-
-    particleSystem.update(deltaTime);
-    particleSystem.render();
+    endGpuPass();
 }
 
 void cleanup() {
-    if (fftCfg) {
-        free(fftCfg);
-        fftCfg = nullptr;
-    }
-    if (fftInput) {
-        free(fftInput);
-        fftInput = nullptr;
-    }
-    if (fftOutput) {
-        free(fftOutput);
-        fftOutput = nullptr;
+    stopAnalysis();
+    stopSpectrumFeed();
+    stopCapture();
+    closeAudio();
+    shutdownProfiler();
+    closeOutputs();
+    destroyBloom();
+    destroySceneTarget();
+    destroyShaders();
+    if (particleSystem) {
+        particleSystem->cleanup();
+        delete particleSystem;
+        particleSystem = nullptr;
     }
 
-    for (int i = 0; i < numBars; ++i) {
-        if (barVAO[i]) {
-            glDeleteVertexArrays(1, &barVAO[i]);
-            barVAO[i] = 0;
-        }
-        if (barVBO[i]) {
-            glDeleteBuffers(1, &barVBO[i]);
-            barVBO[i] = 0;
-        }
+    if (barVAO) {
+        glDeleteVertexArrays(1, &barVAO);
+        barVAO = 0;
     }
-
-    if (audioData) {
-        free(audioData);
-        audioData = nullptr;
+    if (barMeshVBO) {
+        glDeleteBuffers(1, &barMeshVBO);
+        barMeshVBO = 0;
     }
+    streamBuffer.destroy();
 
     if (source) {
+        alSourceStop(source);
         alDeleteSources(1, &source);
         source = 0;
     }
 
-    if (buffer) {
-        alDeleteBuffers(1, &buffer);
-        buffer = 0;
+    if (streamBuffers[0]) {
+        alDeleteBuffers(streamBufferCount, streamBuffers);
+        for (int i = 0; i < streamBufferCount; ++i)
+            streamBuffers[i] = 0;
     }
 
     if (context) {
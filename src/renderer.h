@@ -1,11 +1,30 @@
 #ifndef RENDERER_H
 #define RENDERER_H
 
+#include "particles.h"
+
+// Where particles are simulated; read by setupParticles()
+extern ParticleSimulation particleSimulation;
+
 void initOpenGL();
-void setupBars();
-void processAudioFrame();
-void renderScene();
+void setViewportSize(int width, int height);
+void setupBarMesh();
+// The simulation (particles, camera motion) advances in fixed steps of this
+// many seconds, whatever the frame rate, so it plays out the same at 30 or
+// 240 Hz and offline. Frames are drawn between the last two steps.
+extern const double simulationStep;
+
+// Picks up the newest analysis and runs the steps due by time, this
+// frame's one reading of the clock. A long hitch drops time rather than
+// running a burst of steps.
+void updateScene(double time);
+// Draws the state interpolated to one step before that time, seen from
+// orbitOffset radians further round the camera's orbit. Each output
+// draws its own view of the same state.
+void renderScene(float orbitOffset = 0.0f);
+// Live input: arrival time of the input behind the bars last drawn
+double displayedCaptureTime();
+void setupParticles();
 void setupBaseCircle();
-void renderBaseCircle();
 
 #endif 
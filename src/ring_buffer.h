@@ -0,0 +1,38 @@
+#pragma once
+#include <atomic>
+#include <cstddef>
+
+// Lock-free single-producer/single-consumer ring. Slots are allocated once up
+// front; push and pop copy into/out of them and never block. When the ring is
+// full the producer's frame is dropped rather than waiting for the consumer.
+template <typename T, size_t Capacity>
+class SpscRing {
+    static_assert((Capacity & (Capacity - 1)) == 0, "Capacity must be a power of two");
+
+public:
+    // Producer side
+    bool tryPush(const T& value) {
+        size_t head = head_.load(std::memory_order_relaxed);
+        if (head - tail_.load(std::memory_order_acquire) == Capacity)
+            return false;
+        slots[head & (Capacity - 1)] = value;
+        head_.store(head + 1, std::memory_order_release);
+        return true;
+    }
+
+    // Consumer side: skip everything but the newest entry
+    bool popLatest(T& out) {
+        size_t head = head_.load(std::memory_order_acquire);
+        size_t tail = tail_.load(std::memory_order_relaxed);
+        if (head == tail)
+            return false;
+        out = slots[(head - 1) & (Capacity - 1)];
+        tail_.store(head, std::memory_order_release);
+        return true;
+    }
+
+private:
+    T slots[Capacity];
+    alignas(64) std::atomic<size_t> head_{0};
+    alignas(64) std::atomic<size_t> tail_{0};
+};
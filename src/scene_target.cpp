@@ -0,0 +1,184 @@
+#include "scene_target.h"
+#include <glad/glad.h>
+#include <algorithm>
+#include <cmath>
+#include <iostream>
+#include "bloom.h"
+#include "profiler.h"
+#include "renderer.h"
+
+// Timestamps rather than GL_TIME_ELAPSED, which cannot nest with the
+// profiler's per-pass queries. Read back this many frames later, by which
+// time the GPU has long finished and reading them never stalls.
+const int queryDepth = 3;
+
+// Frames between resolution changes, so each change is measured before the next
+const int adjustInterval = 15;
+// Aim under the target so frame-to-frame noise does not push it over
+const double headroom = 0.85;
+// Changes smaller than this are not worth it; growth is capped per step
+// so a momentarily idle GPU does not cause a bounce
+const float minStep = 0.05f;
+const float maxStepUp = 0.1f;
+
+static SceneTargetConfig config;
+static bool active = false;
+
+// Allocated at the window's size, or the largest window's with several
+// outputs; lower scales and smaller views use its bottom-left corner, so
+// changing the scale never reallocates. The colour is a half-float
+// texture, so bright parts can go past 1 and the bloom pass can read it.
+static GLuint fbo, colorTexture, depthBuffer;
+static int allocatedWidth, allocatedHeight;
+// Largest view this frame; several outputs share the one allocation
+static int neededWidth, neededHeight;
+static int windowWidth, windowHeight;
+static int sceneWidth, sceneHeight;
+static float scale = 1.0f;
+
+static GLuint timestamps[queryDepth][2];
+static bool issued[queryDepth];
+static int querySlot = 0;
+static double smoothedMillis = 0.0;
+static int framesSinceChange = 0;
+// Readings still in flight from before the last change
+static int staleReadings = 0;
+
+void initSceneTarget(const SceneTargetConfig& sceneConfig) {
+    config = sceneConfig;
+    config.minScale = std::clamp(config.minScale, 0.1f, 1.0f);
+
+    glGenFramebuffers(1, &fbo);
+    glGenTextures(1, &colorTexture);
+    glGenRenderbuffers(1, &depthBuffer);
+    glGenQueries(2 * queryDepth, &timestamps[0][0]);
+    active = true;
+}
+
+void destroySceneTarget() {
+    if (!active)
+        return;
+    glDeleteQueries(2 * queryDepth, &timestamps[0][0]);
+    glDeleteRenderbuffers(1, &depthBuffer);
+    glDeleteTextures(1, &colorTexture);
+    glDeleteFramebuffers(1, &fbo);
+    fbo = colorTexture = depthBuffer = 0;
+    allocatedWidth = allocatedHeight = 0;
+    active = false;
+}
+
+static void allocate(int width, int height) {
+    glBindTexture(GL_TEXTURE_2D, colorTexture);
+    glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA16F, width, height, 0, GL_RGBA, GL_HALF_FLOAT, nullptr);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+    glBindTexture(GL_TEXTURE_2D, 0);
+
+    glBindRenderbuffer(GL_RENDERBUFFER, depthBuffer);
+    glRenderbufferStorage(GL_RENDERBUFFER, GL_DEPTH_COMPONENT24, width, height);
+    glBindRenderbuffer(GL_RENDERBUFFER, 0);
+
+    glBindFramebuffer(GL_FRAMEBUFFER, fbo);
+    glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, colorTexture, 0);
+    glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_RENDERBUFFER, depthBuffer);
+    if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE)
+        std::cerr << "Scene framebuffer incomplete at " << width << "x" << height << "\n";
+
+    allocatedWidth = width;
+    allocatedHeight = height;
+}
+
+// Picks up the GPU time of the frame that last used this query slot
+static void readTimestamps() {
+    if (!issued[querySlot])
+        return;
+    issued[querySlot] = false;
+
+    GLint available = 0;
+    glGetQueryObjectiv(timestamps[querySlot][1], GL_QUERY_RESULT_AVAILABLE, &available);
+    if (!available)
+        return;
+
+    GLuint64 begin = 0, end = 0;
+    glGetQueryObjectui64v(timestamps[querySlot][0], GL_QUERY_RESULT, &begin);
+    glGetQueryObjectui64v(timestamps[querySlot][1], GL_QUERY_RESULT, &end);
+    if (staleReadings > 0) {
+        --staleReadings;
+        return;
+    }
+
+    double millis = (end - begin) / 1.0e6;
+    smoothedMillis = smoothedMillis > 0.0 ? smoothedMillis + 0.1 * (millis - smoothedMillis) : millis;
+}
+
+// Fill cost goes with the pixel count, so with the square of the scale
+static void adjustScale() {
+    if (config.targetMillis <= 0.0 || smoothedMillis <= 0.0 || ++framesSinceChange < adjustInterval)
+        return;
+
+    float ideal = scale * float(std::sqrt(headroom * config.targetMillis / smoothedMillis));
+    // Drop straight to what fits, climb back a step at a time
+    float next = std::clamp(std::min(ideal, scale + maxStepUp), config.minScale, 1.0f);
+    // Small corrections are not worth a visible change, unless they reach a limit
+    bool atLimit = next == 1.0f || next == config.minScale;
+    if (next == scale || (std::fabs(next - scale) < minStep && !atLimit))
+        return;
+
+    scale = next;
+    framesSinceChange = 0;
+    smoothedMillis = 0.0;
+    staleReadings = queryDepth;
+}
+
+void beginSceneFrame() {
+    // Shrinks once the views of the last frame all fit in less
+    if (neededWidth > 0 && (neededWidth != allocatedWidth || neededHeight != allocatedHeight))
+        allocate(neededWidth, neededHeight);
+    neededWidth = neededHeight = 0;
+
+    readTimestamps();
+    adjustScale();
+    glQueryCounter(timestamps[querySlot][0], GL_TIMESTAMP);
+}
+
+void endSceneFrame() {
+    glQueryCounter(timestamps[querySlot][1], GL_TIMESTAMP);
+    issued[querySlot] = true;
+    querySlot = (querySlot + 1) % queryDepth;
+}
+
+void beginSceneTarget(int width, int height) {
+    windowWidth = std::max(width, 1);
+    windowHeight = std::max(height, 1);
+    neededWidth = std::max(neededWidth, windowWidth);
+    neededHeight = std::max(neededHeight, windowHeight);
+    if (windowWidth > allocatedWidth || windowHeight > allocatedHeight)
+        allocate(std::max(windowWidth, allocatedWidth), std::max(windowHeight, allocatedHeight));
+
+    sceneWidth = std::max(1, (int)std::lround(windowWidth * scale));
+    sceneHeight = std::max(1, (int)std::lround(windowHeight * scale));
+
+    glBindFramebuffer(GL_FRAMEBUFFER, fbo);
+    setViewportSize(sceneWidth, sceneHeight);
+}
+
+void endSceneTarget(unsigned framebuffer) {
+    beginGpuPass(GpuPass::Bloom);
+    renderBloom(colorTexture, sceneWidth, sceneHeight, allocatedWidth, allocatedHeight);
+
+    // Scaling up happens as the scene is drawn into the window
+    glBindFramebuffer(GL_FRAMEBUFFER, framebuffer);
+    glViewport(0, 0, windowWidth, windowHeight);
+    compositeScene(colorTexture, float(sceneWidth) / allocatedWidth, float(sceneHeight) / allocatedHeight);
+    endGpuPass();
+}
+
+float sceneScale() {
+    return scale;
+}
+
+double sceneGpuMillis() {
+    return smoothedMillis;
+}
@@ -0,0 +1,38 @@
+#ifndef SCENE_TARGET_H
+#define SCENE_TARGET_H
+
+// The scene is drawn into an offscreen framebuffer and scaled up into the
+// window. Its resolution follows the GPU: every frame's GPU time is read
+// back a few frames later, and when it runs over the target the scene is
+// rendered at a lower fraction of the window's size, down to minScale,
+// then brought back up once there is room again. Slower machines get a
+// softer picture instead of missed frames.
+struct SceneTargetConfig {
+    double targetMillis = 16.6;  // GPU time per frame to stay under; 0 keeps full resolution
+    float minScale = 0.5f;       // lowest resolution, as a fraction of the window per axis
+};
+
+// Needs the GL context current
+void initSceneTarget(const SceneTargetConfig& config);
+void destroySceneTarget();
+
+// Bracket every view drawn in a frame; the GPU time between them is what
+// the resolution follows
+void beginSceneFrame();
+void endSceneFrame();
+
+// Binds the offscreen framebuffer for a window framebuffer of the given
+// size and sets the viewport to the part the scene is drawn at this frame.
+// Several views per frame each get their own begin/end pair.
+void beginSceneTarget(int windowWidth, int windowHeight);
+// Adds the bloom, scales the scene into the window's framebuffer (0, or
+// another one of the same size) and leaves that bound, with a viewport
+// covering all of it
+void endSceneTarget(unsigned framebuffer = 0);
+
+// Current resolution scale, 1 for full resolution
+float sceneScale();
+// Smoothed GPU time per frame, in milliseconds
+double sceneGpuMillis();
+
+#endif
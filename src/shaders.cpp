@@ -1,26 +1,66 @@
 #include "shaders.h"
 #include <iostream>
 #include <cmath>
+#include <cstring>
+#include <glm/gtc/type_ptr.hpp>
+#include "program_cache.h"
+#include "stream_buffer.h"
 
 const char* vertexShaderSource = R"(
 #version 330 core
 layout(location = 0) in vec3 position;
 
 uniform mat4 model;
-uniform mat4 view;
-uniform mat4 projection;
+layout(std140) uniform FrameUniforms {
+    mat4 view;
+    mat4 projection;
+    float time;
+};
 
 void main() {
     gl_Position = projection * view * model * vec4(position, 1.0);
 }
 )";
 
+// Bars are drawn instanced: one static cube with its base at y = 0 and top at
+// y = 1, placed on the ring and stretched to the bar height per instance.
+const char* barVertexShaderSource = R"(
+#version 330 core
+layout(location = 0) in vec3 position;
+layout(location = 1) in float angle;
+layout(location = 2) in float height;
+
+layout(std140) uniform FrameUniforms {
+    mat4 view;
+    mat4 projection;
+    float time;
+};
+uniform float ringRadius;
+
+void main() {
+    float c = cos(angle);
+    float s = sin(angle);
+    vec3 local = vec3(position.x, position.y * height, position.z);
+
+    // Same as translate(ringRadius * (c, 0, s)) * rotate(-angle, Y)
+    vec3 world = vec3(c * local.x - s * local.z + ringRadius * c,
+                      local.y,
+                      s * local.x + c * local.z + ringRadius * s);
+
+    gl_Position = projection * view * vec4(world, 1.0);
+}
+)";
+
 
 const char* fragmentShaderSource = R"(
 #version 330 core
 out vec4 color;
 
-uniform float time;  // Time to animate the rainbow effect
+layout(std140) uniform FrameUniforms {
+    mat4 view;
+    mat4 projection;
+    float time;
+};  // time animates the rainbow effect
 
 void main() {
     float speed = 0.2; // Adjust this to control how fast the color cycles
@@ -39,48 +79,514 @@ void main() {
 
 
 
+// Particle simulation step, run with rasterisation off and the outputs
+// captured into the other particle buffer by transform feedback
+const char* particleUpdateShaderSource = R"(
+#version 330 core
+layout(location = 0) in vec3 position;
+layout(location = 1) in vec3 velocity;
+layout(location = 2) in float life;
+layout(location = 3) in float size;
 
-GLuint shaderProgram;
+out vec3 outPosition;
+out vec3 outVelocity;
+out float outLife;
+out float outSize;
 
-// Function to create shaders
-void createShaders() {
-    GLuint vertexShader = glCreateShader(GL_VERTEX_SHADER);
-    glShaderSource(vertexShader, 1, &vertexShaderSource, nullptr);
-    glCompileShader(vertexShader);
+uniform float deltaTime;
+
+void main() {
+    outPosition = position;
+    outVelocity = velocity;
+    outLife = life;
+    outSize = size;
+
+    if (life > 0.0) {
+        // Spiral motion
+        vec2 tangent = vec2(-position.y, position.x);
+        float len = length(tangent);
+        if (len > 0.0)
+            outVelocity.xy += tangent / len * 0.2 * deltaTime;
+
+        outPosition += outVelocity * deltaTime;
+        outLife = life - deltaTime * 0.5;
+    }
+}
+)";
+
+const char* particleVertexShaderSource = R"(
+#version 330 core
+layout(location = 0) in vec3 position;
+layout(location = 1) in vec3 velocity;
+layout(location = 2) in float life;
+layout(location = 3) in float size;
+
+layout(std140) uniform FrameUniforms {
+    mat4 view;
+    mat4 projection;
+    float time;
+};
+uniform float viewportHeight;
+// Seconds before the last update to draw at. An update moves a particle by
+// its new velocity and takes life at 0.5 per second, so this undoes part
+// of one exactly.
+uniform float behind;
+
+out float particleLife;
+
+void main() {
+    particleLife = min(life + 0.5 * behind, 1.0);
+    if (life <= 0.0) {
+        // Dead slots are pushed outside the clip volume
+        gl_Position = vec4(2.0, 2.0, 2.0, 1.0);
+        gl_PointSize = 1.0;
+        return;
+    }
+
+    gl_Position = projection * view * vec4(position - velocity * behind, 1.0);
+
+    // World-space size to pixels at this depth
+    gl_PointSize = max(size * projection[1][1] * 0.5 * viewportHeight / gl_Position.w, 1.0);
+}
+)";
+
+const char* particleFragmentShaderSource = R"(
+#version 330 core
+in float particleLife;
+out vec4 color;
+
+// Fresh particles go past 1 in the HDR scene, so they glow the most
+const float emission = 1.5;
+
+void main() {
+    vec2 d = gl_PointCoord - vec2(0.5);
+    if (dot(d, d) > 0.25)
+        discard;
+
+    color = vec4(vec3(particleLife, 0.8 * particleLife, 0.2) * emission, particleLife);
+}
+)";
+
+// Flat 2D geometry for the profiler overlay, already in clip space
+const char* overlayVertexShaderSource = R"(
+#version 330 core
+layout(location = 0) in vec2 position;
+layout(location = 1) in vec3 vertexColor;
+out vec3 overlayColor;
+
+void main() {
+    overlayColor = vertexColor;
+    gl_Position = vec4(position, 0.0, 1.0);
+}
+)";
+
+const char* overlayFragmentShaderSource = R"(
+#version 330 core
+in vec3 overlayColor;
+out vec4 color;
+
+void main() {
+    color = vec4(overlayColor, 0.8);
+}
+)";
+
+// Full-screen passes: one triangle covering the viewport, with uv running
+// 0..1 across it. No vertex buffer; the corners come from gl_VertexID.
+const char* fullscreenVertexShaderSource = R"(
+#version 330 core
+out vec2 uv;
+
+void main() {
+    uv = vec2((gl_VertexID << 1) & 2, gl_VertexID & 2);
+    gl_Position = vec4(uv * 2.0 - 1.0, 0.0, 1.0);
+}
+)";
+
+// Bloom sources fill only the bottom-left sourceScale of their texture;
+// taps are kept half a texel inside it so nothing outside bleeds in
+const char* bloomDownsampleShaderSource = R"(
+#version 330 core
+in vec2 uv;
+out vec4 color;
+
+uniform sampler2D source;
+uniform vec2 sourceScale;
+uniform vec2 texel;         // one source texel in texture coordinates
+uniform float threshold;    // first pass only: keeps what is brighter; 0 keeps everything
+uniform float knee;         // eases the threshold in over this much brightness
+
+vec3 fetch(vec2 at) {
+    return texture(source, clamp(at, texel * 0.5, sourceScale - texel * 0.5)).rgb;
+}
+
+vec3 brightPass(vec3 c) {
+    float brightness = max(c.r, max(c.g, c.b));
+    float soft = clamp(brightness - threshold + knee, 0.0, 2.0 * knee);
+    soft = soft * soft / (4.0 * knee + 1e-4);
+    return c * max(soft, brightness - threshold) / max(brightness, 1e-4);
+}
+
+void main() {
+    // Dual-filter (Kawase) downsample: the centre and four diagonal taps,
+    // each bilinear, so 16 texels of the source for every output texel
+    vec2 at = uv * sourceScale;
+    vec3 sum = fetch(at) * 4.0;
+    sum += fetch(at + vec2(-texel.x, -texel.y));
+    sum += fetch(at + vec2(texel.x, -texel.y));
+    sum += fetch(at + vec2(-texel.x, texel.y));
+    sum += fetch(at + vec2(texel.x, texel.y));
+    sum /= 8.0;
+
+    color = vec4(threshold > 0.0 ? brightPass(sum) : sum, 1.0);
+}
+)";
+
+const char* bloomUpsampleShaderSource = R"(
+#version 330 core
+in vec2 uv;
+out vec4 color;
+
+uniform sampler2D source;
+uniform vec2 sourceScale;
+uniform vec2 texel;
+
+vec3 fetch(vec2 at) {
+    return texture(source, clamp(at, texel * 0.5, sourceScale - texel * 0.5)).rgb;
+}
 
+void main() {
+    // Dual-filter upsample: a tent of four edge and four diagonal taps;
+    // added onto the level below by blending
+    vec2 at = uv * sourceScale;
+    vec3 sum = fetch(at + vec2(-2.0 * texel.x, 0.0));
+    sum += fetch(at + vec2(2.0 * texel.x, 0.0));
+    sum += fetch(at + vec2(0.0, -2.0 * texel.y));
+    sum += fetch(at + vec2(0.0, 2.0 * texel.y));
+    sum += fetch(at + vec2(-texel.x, -texel.y)) * 2.0;
+    sum += fetch(at + vec2(texel.x, -texel.y)) * 2.0;
+    sum += fetch(at + vec2(-texel.x, texel.y)) * 2.0;
+    sum += fetch(at + vec2(texel.x, texel.y)) * 2.0;
+
+    color = vec4(sum / 12.0, 1.0);
+}
+)";
+
+// The scene scaled into the window, with the glow added on top
+const char* compositeShaderSource = R"(
+#version 330 core
+in vec2 uv;
+out vec4 color;
+
+uniform sampler2D scene;
+uniform sampler2D bloom;
+uniform vec2 sceneScale;
+uniform vec2 sceneTexel;
+uniform vec2 bloomScale;
+uniform vec2 bloomTexel;
+uniform float strength;
+
+void main() {
+    vec3 base = texture(scene, clamp(uv * sceneScale, sceneTexel * 0.5, sceneScale - sceneTexel * 0.5)).rgb;
+    vec3 glow = texture(bloom, clamp(uv * bloomScale, bloomTexel * 0.5, bloomScale - bloomTexel * 0.5)).rgb;
+    color = vec4(base + glow * strength, 1.0);
+}
+)";
+
+// A finished frame copied into another window as is
+const char* presentShaderSource = R"(
+#version 330 core
+in vec2 uv;
+out vec4 color;
+
+uniform sampler2D frame;
+
+void main() {
+    color = vec4(texture(frame, uv).rgb, 1.0);
+}
+)";
+
+
+ShaderProgram baseProgram;
+ShaderProgram barProgram;
+ShaderProgram particleUpdateProgram;
+ShaderProgram particleProgram;
+ShaderProgram overlayProgram;
+ShaderProgram bloomDownsampleProgram;
+ShaderProgram bloomUpsampleProgram;
+ShaderProgram compositeProgram;
+ShaderProgram presentProgram;
+
+// Each frame's block is a fresh slice of the stream buffer at this alignment
+static GLint uniformAlignment = 256;
+
+// GL_KHR_parallel_shader_compile, which glad is not generated with
+const GLenum completionStatus = 0x91B1;  // GL_COMPLETION_STATUS_KHR
+typedef void (APIENTRYP MaxShaderCompilerThreadsProc)(GLuint count);
+
+// Set when the driver links in the background and can be polled
+static bool parallelCompile = false;
+
+// Shader startup time is reported once every program is done
+static double startupBegin;
+static bool startupReported = false;
+
+static ShaderProgram* const allPrograms[] = {
+    &baseProgram, &barProgram, &particleUpdateProgram, &particleProgram, &overlayProgram,
+    &bloomDownsampleProgram, &bloomUpsampleProgram, &compositeProgram, &presentProgram
+};
+
+// Must match the Particle layout in particles.h
+static const char* const particleVaryings[] = { "outPosition", "outVelocity", "outLife", "outSize" };
+
+static GLuint startShader(GLenum type, const char* source) {
+    GLuint shader = glCreateShader(type);
+    glShaderSource(shader, 1, &source, nullptr);
+    glCompileShader(shader);
+    return shader;
+}
+
+// Issues the compile and link without asking for their status, which
+// would make the driver finish them on the spot. fragmentSource may be
+// null for programs that only feed transform feedback.
+void ShaderProgram::compile() {
+    vertexShader = startShader(GL_VERTEX_SHADER, vertexSource);
+    fragmentShader = fragmentSource ? startShader(GL_FRAGMENT_SHADER, fragmentSource) : 0;
+
+    glAttachShader(program, vertexShader);
+    if (fragmentShader)
+        glAttachShader(program, fragmentShader);
+    if (feedbackVaryings)
+        glTransformFeedbackVaryings(program, feedbackCount, feedbackVaryings, GL_INTERLEAVED_ATTRIBS);
+    if (programCacheEnabled())
+        glProgramParameteri(program, GL_PROGRAM_BINARY_RETRIEVABLE_HINT, GL_TRUE);
+    glLinkProgram(program);
+}
+
+void ShaderProgram::reportErrors() const {
     GLint success;
+    char infoLog[512];
     glGetShaderiv(vertexShader, GL_COMPILE_STATUS, &success);
     if (!success) {
-        char infoLog[512];
         glGetShaderInfoLog(vertexShader, 512, nullptr, infoLog);
         std::cerr << "Vertex Shader compilation failed:\n" << infoLog << std::endl;
     }
+    if (fragmentShader) {
+        glGetShaderiv(fragmentShader, GL_COMPILE_STATUS, &success);
+        if (!success) {
+            glGetShaderInfoLog(fragmentShader, 512, nullptr, infoLog);
+            std::cerr << "Fragment Shader compilation failed:\n" << infoLog << std::endl;
+        }
+    }
+    glGetProgramInfoLog(program, 512, nullptr, infoLog);
+    std::cerr << "Shader Program linking failed:\n" << infoLog << std::endl;
+}
 
-    GLuint fragmentShader = glCreateShader(GL_FRAGMENT_SHADER);
-    glShaderSource(fragmentShader, 1, &fragmentShaderSource, nullptr);
-    glCompileShader(fragmentShader);
+void ShaderProgram::start(const char* vertex, const char* fragment,
+                          const char* const* varyings, int varyingCount) {
+    destroy();
+    vertexSource = vertex;
+    fragmentSource = fragment;
+    feedbackVaryings = varyings;
+    feedbackCount = varyingCount;
 
-    glGetShaderiv(fragmentShader, GL_COMPILE_STATUS, &success);
-    if (!success) {
-        char infoLog[512];
-        glGetShaderInfoLog(fragmentShader, 512, nullptr, infoLog);
-        std::cerr << "Fragment Shader compilation failed:\n" << infoLog << std::endl;
+    program = glCreateProgram();
+    cacheKey = programCacheKey(vertexSource, fragmentSource, feedbackVaryings, feedbackCount);
+    cached = loadCachedProgram(program, cacheKey);
+    if (!cached)
+        compile();
+}
+
+bool ShaderProgram::linkDone() const {
+    if (isFinished || !parallelCompile)
+        return true;
+    GLint done = GL_FALSE;
+    glGetProgramiv(program, completionStatus, &done);
+    return done == GL_TRUE;
+}
+
+bool ShaderProgram::finish() {
+    GLint linked = 0;
+    if (isFinished) {
+        glGetProgramiv(program, GL_LINK_STATUS, &linked);
+        return linked;
     }
+    isFinished = true;
 
-    shaderProgram = glCreateProgram();
-    glAttachShader(shaderProgram, vertexShader);
-    glAttachShader(shaderProgram, fragmentShader);
-    glLinkProgram(shaderProgram);
+    glGetProgramiv(program, GL_LINK_STATUS, &linked);
+    // A binary from before a driver change; build this one from source
+    if (!linked && cached) {
+        forgetCachedProgram(cacheKey);
+        glDeleteProgram(program);
+        program = glCreateProgram();
+        cached = false;
+        compile();
+        glGetProgramiv(program, GL_LINK_STATUS, &linked);
+    }
+    if (!linked)
+        reportErrors();
+    else if (!cached)
+        storeCachedProgram(program, cacheKey);
 
-    glGetProgramiv(shaderProgram, GL_LINK_STATUS, &success);
-    if (!success) {
-        char infoLog[512];
-        glGetProgramInfoLog(shaderProgram, 512, nullptr, infoLog);
-        std::cerr << "Shader Program linking failed:\n" << infoLog << std::endl;
+    if (vertexShader)
+        glDeleteShader(vertexShader);
+    if (fragmentShader)
+        glDeleteShader(fragmentShader);
+    vertexShader = fragmentShader = 0;
+    if (!linked)
+        return false;
+
+    // Resolve every active uniform once; block members have no location
+    GLint count = 0;
+    glGetProgramiv(program, GL_ACTIVE_UNIFORMS, &count);
+    for (GLint i = 0; i < count; ++i) {
+        char name[128];
+        GLint size;
+        GLenum type;
+        glGetActiveUniform(program, i, sizeof(name), nullptr, &size, &type, name);
+
+        GLint location = glGetUniformLocation(program, name);
+        if (location >= 0)
+            uniforms.push_back({ name, location, {}, false });
     }
 
-    glDeleteShader(vertexShader);
-    glDeleteShader(fragmentShader);
+    GLuint blockIndex = glGetUniformBlockIndex(program, "FrameUniforms");
+    if (blockIndex != GL_INVALID_INDEX)
+        glUniformBlockBinding(program, blockIndex, frameUniformBinding);
+    return true;
+}
+
+void ShaderProgram::destroy() {
+    if (vertexShader)
+        glDeleteShader(vertexShader);
+    if (fragmentShader)
+        glDeleteShader(fragmentShader);
+    if (program)
+        glDeleteProgram(program);
+    program = vertexShader = fragmentShader = 0;
+    uniforms.clear();
+    cached = false;
+    isFinished = false;
+}
+
+int ShaderProgram::uniform(const char* name) const {
+    for (size_t i = 0; i < uniforms.size(); ++i)
+        if (uniforms[i].name == name)
+            return (int)i;
+    return -1;
 }
 
+// Returns true when the value differs from what was last uploaded
+bool ShaderProgram::changed(int handle, const void* value, size_t size) {
+    Uniform& u = uniforms[handle];
+    if (u.valid && memcmp(u.value, value, size) == 0)
+        return false;
+    memcpy(u.value, value, size);
+    u.valid = true;
+    return true;
+}
+
+void ShaderProgram::set(int handle, float value) {
+    if (handle >= 0 && changed(handle, &value, sizeof(value)))
+        glUniform1f(uniforms[handle].location, value);
+}
+
+void ShaderProgram::set(int handle, int value) {
+    if (handle >= 0 && changed(handle, &value, sizeof(value)))
+        glUniform1i(uniforms[handle].location, value);
+}
 
+void ShaderProgram::set(int handle, const glm::vec2& value) {
+    if (handle >= 0 && changed(handle, glm::value_ptr(value), sizeof(value)))
+        glUniform2f(uniforms[handle].location, value.x, value.y);
+}
+
+void ShaderProgram::set(int handle, const glm::mat4& value) {
+    if (handle >= 0 && changed(handle, glm::value_ptr(value), sizeof(value)))
+        glUniformMatrix4fv(uniforms[handle].location, 1, GL_FALSE, glm::value_ptr(value));
+}
+
+// Asks the driver for as many compiler threads as it likes
+static void enableParallelCompile() {
+    MaxShaderCompilerThreadsProc maxThreads = nullptr;
+    if (glfwExtensionSupported("GL_KHR_parallel_shader_compile"))
+        maxThreads = (MaxShaderCompilerThreadsProc)glfwGetProcAddress("glMaxShaderCompilerThreadsKHR");
+    else if (glfwExtensionSupported("GL_ARB_parallel_shader_compile"))
+        maxThreads = (MaxShaderCompilerThreadsProc)glfwGetProcAddress("glMaxShaderCompilerThreadsARB");
+    if (maxThreads)
+        maxThreads(0xFFFFFFFF);
+    parallelCompile = maxThreads != nullptr;
+}
+
+// Function to create shaders
+void createShaders(const std::string& cachePath) {
+    startupBegin = glfwGetTime();
+    openProgramCache(cachePath);
+    enableParallelCompile();
+
+    baseProgram.start(vertexShaderSource, fragmentShaderSource);
+    barProgram.start(barVertexShaderSource, fragmentShaderSource);
+    particleUpdateProgram.start(particleUpdateShaderSource, nullptr, particleVaryings, 4);
+    particleProgram.start(particleVertexShaderSource, particleFragmentShaderSource);
+    overlayProgram.start(overlayVertexShaderSource, overlayFragmentShaderSource);
+    bloomDownsampleProgram.start(fullscreenVertexShaderSource, bloomDownsampleShaderSource);
+    bloomUpsampleProgram.start(fullscreenVertexShaderSource, bloomUpsampleShaderSource);
+    compositeProgram.start(fullscreenVertexShaderSource, compositeShaderSource);
+    presentProgram.start(fullscreenVertexShaderSource, presentShaderSource);
+
+    glGetIntegerv(GL_UNIFORM_BUFFER_OFFSET_ALIGNMENT, &uniformAlignment);
+}
+
+// Cold when anything had to be compiled, warm when it all came from the cache
+static void reportStartup() {
+    int fromCache = 0;
+    for (ShaderProgram* program : allPrograms)
+        fromCache += program->fromCache() ? 1 : 0;
+    const int total = int(sizeof(allPrograms) / sizeof(allPrograms[0]));
+
+    std::clog << "Shaders ready in " << (glfwGetTime() - startupBegin) * 1000.0 << " ms ("
+              << (fromCache == total ? "warm" : "cold") << ", " << fromCache << "/" << total
+              << " from the program cache" << (parallelCompile ? ", parallel compile" : "") << ")\n";
+}
+
+bool shadersReady() {
+    bool ready = true;
+    for (ShaderProgram* program : allPrograms) {
+        if (program->finished())
+            continue;
+        if (program->linkDone())
+            program->finish();
+        else
+            ready = false;
+    }
+
+    if (ready && !startupReported) {
+        startupReported = true;
+        closeProgramCache();
+        reportStartup();
+    }
+    return ready;
+}
+
+void finishShaders() {
+    for (ShaderProgram* program : allPrograms)
+        program->finish();
+    shadersReady();
+}
+
+void updateFrameUniforms(const FrameUniforms& frame) {
+    GLintptr offset = streamBuffer.upload(&frame, sizeof(FrameUniforms), uniformAlignment);
+    if (offset >= 0)
+        glBindBufferRange(GL_UNIFORM_BUFFER, frameUniformBinding, streamBuffer.id(), offset, sizeof(FrameUniforms));
+}
+
+void destroyShaders() {
+    baseProgram.destroy();
+    barProgram.destroy();
+    particleUpdateProgram.destroy();
+    particleProgram.destroy();
+    overlayProgram.destroy();
+    bloomDownsampleProgram.destroy();
+    bloomUpsampleProgram.destroy();
+    compositeProgram.destroy();
+    presentProgram.destroy();
+}
@@ -2,12 +2,111 @@
 #define SHADERS_H
 #include <glad/glad.h>
 #include <GLFW/glfw3.h>
+#include <glm/glm.hpp>
+#include <cstdint>
+#include <string>
+#include <vector>
 
 extern const char* vertexShaderSource;
 extern const char* fragmentShaderSource;
-extern GLuint shaderProgram;
+extern const char* barVertexShaderSource;
+extern const char* particleUpdateShaderSource;
+extern const char* particleVertexShaderSource;
+extern const char* particleFragmentShaderSource;
+extern const char* overlayVertexShaderSource;
+extern const char* overlayFragmentShaderSource;
+extern const char* fullscreenVertexShaderSource;
+extern const char* bloomDownsampleShaderSource;
+extern const char* bloomUpsampleShaderSource;
+extern const char* compositeShaderSource;
+extern const char* presentShaderSource;
 
-void createShaders();
+// Per-frame values shared by every program through one uniform buffer;
+// std140 layout, matching the FrameUniforms block in the shaders
+struct FrameUniforms {
+    glm::mat4 view;
+    glm::mat4 projection;
+    float time;
+    float padding[3];
+};
 
-#endif
+const GLuint frameUniformBinding = 0;
+
+// A linked program whose uniform locations are all looked up at link time.
+// Callers resolve a handle once with uniform() and set values through it;
+// values equal to the last upload are skipped. set() needs the program bound.
+class ShaderProgram {
+public:
+    // Starts linking, from the program binary cache if it has this program
+    // and from source otherwise. The driver may carry on in the background;
+    // the sources must outlive the call to finish().
+    void start(const char* vertexSource, const char* fragmentSource,
+               const char* const* feedbackVaryings = nullptr, int feedbackCount = 0);
+    // True once linking is done; never waits when the driver supports
+    // GL_KHR_parallel_shader_compile
+    bool linkDone() const;
+    // Waits for linking, resolves the uniforms and caches the binary; false if it failed
+    bool finish();
+    bool finished() const { return isFinished; }
+    bool fromCache() const { return cached; }
+    void destroy();
+
+    void use() const { glUseProgram(program); }
+    GLuint id() const { return program; }
+
+    // -1 if the uniform is not active in this program; setting -1 is a no-op
+    int uniform(const char* name) const;
+
+    void set(int handle, float value);
+    void set(int handle, int value);
+    void set(int handle, const glm::vec2& value);
+    void set(int handle, const glm::mat4& value);
+
+private:
+    struct Uniform {
+        std::string name;
+        GLint location;
+        unsigned char value[sizeof(glm::mat4)];
+        bool valid;
+    };
 
+    bool changed(int handle, const void* value, size_t size);
+    void compile();
+    void reportErrors() const;
+
+    GLuint program = 0;
+    std::vector<Uniform> uniforms;
+
+    // Kept from start() until finish()
+    const char* vertexSource = nullptr;
+    const char* fragmentSource = nullptr;
+    const char* const* feedbackVaryings = nullptr;
+    int feedbackCount = 0;
+    GLuint vertexShader = 0, fragmentShader = 0;
+    uint64_t cacheKey = 0;
+    bool cached = false;
+    bool isFinished = false;
+};
+
+extern ShaderProgram baseProgram;
+extern ShaderProgram barProgram;
+extern ShaderProgram particleUpdateProgram;
+extern ShaderProgram particleProgram;
+extern ShaderProgram overlayProgram;
+extern ShaderProgram bloomDownsampleProgram;
+extern ShaderProgram bloomUpsampleProgram;
+extern ShaderProgram compositeProgram;
+extern ShaderProgram presentProgram;
+
+// Starts every program linking, with the binary cache at cachePath (empty
+// for none). They can be used once shadersReady() returns true.
+void createShaders(const std::string& cachePath);
+// Finishes the programs that are done linking; true once all of them are.
+// Never waits when linking runs in the background.
+bool shadersReady();
+// Waits for all of them
+void finishShaders();
+void updateFrameUniforms(const FrameUniforms& frame);
+void destroyShaders();
+
+#endif
@@ -0,0 +1,284 @@
+#include "spectrogram_index.h"
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <iostream>
+#include <unistd.h>
+#include "decoder.h"
+#include "pcm_file.h"
+#include "spectrum.h"
+
+// .spec layout: this header, then hops records of numBars bar bytes
+// followed by featureBytes of features
+struct IndexHeader {
+    char magic[8];
+    uint64_t sourceHash;
+    uint32_t sampleRate;
+    uint32_t fftSize;
+    uint32_t hopSize;
+    uint32_t numBars;
+    uint32_t barScale;
+    uint32_t recordSize;
+    int64_t hops;
+};
+
+static const char indexMagic[8] = { 'C', 'R', 'S', 'L', 'S', 'P', 'C', '1' };
+
+static_assert(sizeof(IndexHeader) == 48, "IndexHeader is written to disk as is");
+
+// Per hop after the bars: four band levels, onset strength, flags, tempo
+// in whole BPM and tempo confidence
+const int featureBytes = BandCount + 4;
+const uint8_t onsetFlag = 1;
+
+static uint8_t quantise(float value, float range) {
+    return uint8_t(std::lround(std::clamp(value / range, 0.0f, 1.0f) * 255.0f));
+}
+
+// FNV-1a over the whole file; cheap next to the analysis it saves
+static bool hashFile(const char* path, uint64_t& hash) {
+    FILE* file = fopen(path, "rb");
+    if (!file)
+        return false;
+
+    hash = 14695981039346656037ull;
+    unsigned char buffer[1 << 16];
+    size_t n;
+    while ((n = fread(buffer, 1, sizeof(buffer), file)) > 0) {
+        for (size_t i = 0; i < n; ++i)
+            hash = (hash ^ buffer[i]) * 1099511628211ull;
+    }
+    bool ok = !ferror(file);
+    fclose(file);
+    return ok;
+}
+
+bool SpectrogramIndex::load(const std::string& path, uint64_t sourceHash, const AnalysisConfig& config) {
+    FILE* file = fopen(path.c_str(), "rb");
+    if (!file)
+        return false;
+
+    IndexHeader header;
+    bool ok = fread(&header, sizeof(header), 1, file) == 1 &&
+              memcmp(header.magic, indexMagic, sizeof(indexMagic)) == 0 &&
+              header.sourceHash == sourceHash && header.sampleRate > 0 &&
+              header.fftSize == uint32_t(config.fftSize) && header.hopSize == uint32_t(config.hopSize) &&
+              header.numBars == uint32_t(config.numBars) && header.barScale == uint32_t(config.barScale) &&
+              header.recordSize == uint32_t(config.numBars + featureBytes) && header.hops > 0;
+    if (ok) {
+        records.resize(size_t(header.hops) * header.recordSize);
+        ok = fread(records.data(), 1, records.size(), file) == records.size();
+    }
+    fclose(file);
+
+    if (!ok) {
+        records.clear();
+        return false;
+    }
+
+    sampleRate = int(header.sampleRate);
+    fftSize = config.fftSize;
+    hopSize = config.hopSize;
+    numBars = config.numBars;
+    barScale = config.barScale;
+    hops = header.hops;
+    countOnsets();
+    return true;
+}
+
+bool SpectrogramIndex::build(const char* audioPath, uint64_t sourceHash, const AnalysisConfig& config,
+                             const std::atomic<bool>& abort) {
+    // Same sources as playback: a mapping if there is one, else the decoder
+    MappedPcm mapped;
+    VorbisStream stream;
+    bool isMapped = isPcmFile(audioPath) ? mapped.open(audioPath) : mapped.openCache(audioPath);
+    if (!isMapped && !stream.open(audioPath))
+        return false;
+
+    const int sourceChannels = isMapped ? mapped.channels : stream.channels;
+    sampleRate = isMapped ? mapped.sampleRate : stream.sampleRate;
+    fftSize = config.fftSize;
+    hopSize = config.hopSize;
+    numBars = config.numBars;
+    barScale = config.barScale;
+
+    SpectrumAnalyzer analyzer(fftSize);
+    BarMapping mapping;
+    mapping.build(fftSize, sampleRate, numBars, barScale);
+    FeatureExtractor extractor;
+    extractor.configure(fftSize, sampleRate, double(hopSize) / sampleRate);
+
+    std::vector<float> window(fftSize), binHeights(fftSize / 2), bars(numBars);
+    AudioFeatures features;
+
+    // Mono frames from bufferStart on. The first window is centred on frame
+    // 0, so the buffer starts half a window early in silence.
+    std::vector<float> buffer(fftSize / 2, 0.0f);
+    long long bufferStart = -fftSize / 2;
+    long long sourceFrames = 0;
+    bool ended = false;
+
+    const int chunkFrames = 1 << 14;
+    std::vector<short> chunk(size_t(chunkFrames) * sourceChannels);
+
+    auto started = std::chrono::steady_clock::now();
+    const int recordSize = numBars + featureBytes;
+    records.clear();
+    hops = 0;
+
+    while (!abort.load(std::memory_order_relaxed)) {
+        long long start = hops * hopSize - fftSize / 2;
+        while (!ended && bufferStart + (long long)buffer.size() < start + fftSize) {
+            int frames;
+            const short* data = chunk.data();
+            if (isMapped) {
+                frames = (int)std::min<long long>(chunkFrames, mapped.lengthFrames - sourceFrames);
+                data = mapped.frames() + sourceFrames * sourceChannels;
+            } else {
+                frames = stream.read(chunk.data(), chunkFrames);
+            }
+            if (frames <= 0) {
+                ended = true;
+                break;
+            }
+            for (int i = 0; i < frames; ++i) {
+                float sum = 0.0f;
+                for (int c = 0; c < sourceChannels; ++c)
+                    sum += data[i * sourceChannels + c];
+                buffer.push_back(sum / sourceChannels);
+            }
+            sourceFrames += frames;
+        }
+        if (ended && hops * hopSize >= sourceFrames)
+            break;
+
+        // Past the end of the track reads as silence, as in readMonoFrames()
+        for (int i = 0; i < fftSize; ++i) {
+            size_t offset = size_t(start + i - bufferStart);
+            window[i] = offset < buffer.size() ? buffer[offset] : 0.0f;
+        }
+
+        analyzer.analyse(window.data(), binHeights.data());
+        extractor.update(binHeights.data(), features);
+        mapping.apply(binHeights.data(), bars.data());
+
+        size_t at = records.size();
+        records.resize(at + recordSize);
+        uint8_t* record = &records[at];
+        for (int i = 0; i < numBars; ++i)
+            record[i] = quantise(bars[i], SpectrumAnalyzer::maxBarHeight);
+        uint8_t* packed = record + numBars;
+        for (int b = 0; b < BandCount; ++b)
+            packed[b] = quantise(features.bands[b], 1.0f);
+        packed[BandCount] = quantise(features.onsetStrength, 1.0f);
+        packed[BandCount + 1] = features.onset ? onsetFlag : 0;
+        packed[BandCount + 2] = uint8_t(std::clamp(std::lround(features.tempo), 0l, 255l));
+        packed[BandCount + 3] = quantise(features.tempoConfidence, 1.0f);
+        ++hops;
+
+        // Drop what later windows no longer need, a block at a time
+        long long keepFrom = hops * hopSize - fftSize / 2;
+        if (keepFrom - bufferStart >= chunkFrames) {
+            buffer.erase(buffer.begin(), buffer.begin() + (keepFrom - bufferStart));
+            bufferStart = keepFrom;
+        }
+    }
+
+    if (abort.load(std::memory_order_relaxed) || hops == 0) {
+        records.clear();
+        hops = 0;
+        return false;
+    }
+    countOnsets();
+
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - started).count();
+    std::clog << "Spectrogram index built: " << hops << " hops in " << seconds << " s\n";
+
+    // A read-only asset directory only costs the next run a rebuild
+    write(spectrogramIndexPath(audioPath), sourceHash);
+    return true;
+}
+
+// Written to a temporary file and renamed, so a partial index is never read
+bool SpectrogramIndex::write(const std::string& path, uint64_t sourceHash) const {
+    const std::string tempPath = path + ".tmp";
+    FILE* out = fopen(tempPath.c_str(), "wb");
+    if (!out)
+        return false;
+
+    IndexHeader header = {};
+    memcpy(header.magic, indexMagic, sizeof(indexMagic));
+    header.sourceHash = sourceHash;
+    header.sampleRate = uint32_t(sampleRate);
+    header.fftSize = uint32_t(fftSize);
+    header.hopSize = uint32_t(hopSize);
+    header.numBars = uint32_t(numBars);
+    header.barScale = uint32_t(barScale);
+    header.recordSize = uint32_t(numBars + featureBytes);
+    header.hops = hops;
+
+    bool ok = fwrite(&header, sizeof(header), 1, out) == 1 &&
+              fwrite(records.data(), 1, records.size(), out) == records.size();
+    ok = fclose(out) == 0 && ok;
+
+    if (!ok || rename(tempPath.c_str(), path.c_str()) != 0) {
+        unlink(tempPath.c_str());
+        return false;
+    }
+    return true;
+}
+
+void SpectrogramIndex::countOnsets() {
+    const int recordSize = numBars + featureBytes;
+    onsetTotals.resize(hops);
+    unsigned total = 0;
+    for (long long i = 0; i < hops; ++i) {
+        if (records[i * recordSize + numBars + BandCount + 1] & onsetFlag)
+            ++total;
+        onsetTotals[i] = total;
+    }
+}
+
+void SpectrogramIndex::frameAt(double time, SpectrumFrame& out) const {
+    long long hop = std::clamp<long long>(std::llround(time * sampleRate / hopSize), 0, hops - 1);
+    const uint8_t* record = &records[hop * (numBars + featureBytes)];
+
+    const float heightPerStep = SpectrumAnalyzer::maxBarHeight / 255.0f;
+    out.bars.resize(numBars);
+    for (int i = 0; i < numBars; ++i)
+        out.bars[i] = record[i] * heightPerStep;
+    out.position = hop * hopSize - fftSize / 2;
+    out.capturedAt = 0.0;
+
+    const uint8_t* packed = record + numBars;
+    AudioFeatures& features = out.features;
+    for (int b = 0; b < BandCount; ++b)
+        features.bands[b] = packed[b] / 255.0f;
+    features.onsetStrength = packed[BandCount] / 255.0f;
+    features.onset = (packed[BandCount + 1] & onsetFlag) != 0;
+    features.onsetCount = onsetTotals[hop];
+    features.tempo = packed[BandCount + 2];
+    features.tempoConfidence = packed[BandCount + 3] / 255.0f;
+}
+
+std::string spectrogramIndexPath(const char* audioPath) {
+    return std::string(audioPath) + ".spec";
+}
+
+SpectrogramIndex* loadSpectrogramIndex(const char* audioPath, const AnalysisConfig& config,
+                                       const std::atomic<bool>& abort) {
+    uint64_t hash;
+    if (!hashFile(audioPath, hash))
+        return nullptr;
+
+    SpectrogramIndex* index = new SpectrogramIndex;
+    if (index->load(spectrogramIndexPath(audioPath), hash, config)) {
+        std::clog << "Spectrogram index loaded: " << index->hopCount() << " hops\n";
+    } else if (!index->build(audioPath, hash, config, abort)) {
+        delete index;
+        return nullptr;
+    }
+    return index;
+}
@@ -0,0 +1,58 @@
+#ifndef SPECTROGRAM_INDEX_H
+#define SPECTROGRAM_INDEX_H
+
+#include <atomic>
+#include <cstdint>
+#include <string>
+#include <vector>
+#include "analysis.h"
+
+// The whole track analysed ahead of time: bars and features for every hop,
+// quantised to a byte each, so any moment can be looked up in O(1) instead
+// of being recomputed from the audio. Seeking and offline rendering read
+// the same frames playback does, and the onset and smoothing state is never
+// out of step with the position.
+//
+// Hop i is the window centred on frame i * hopSize. The index lives next to
+// the audio as FILE.spec and is keyed by a hash of the file's contents and
+// the analysis config; a mismatch on either rebuilds it.
+class SpectrogramIndex {
+public:
+    // Reads a sidecar written for this source and config
+    bool load(const std::string& path, uint64_t sourceHash, const AnalysisConfig& config);
+    // Analyses the whole source and writes the sidecar; false on abort
+    bool build(const char* audioPath, uint64_t sourceHash, const AnalysisConfig& config,
+               const std::atomic<bool>& abort);
+
+    // The hop nearest the given track time, clamped to the track; position
+    // is the track frame the window starts at
+    void frameAt(double time, SpectrumFrame& out) const;
+
+    long long hopCount() const { return hops; }
+
+private:
+    bool write(const std::string& path, uint64_t sourceHash) const;
+    void countOnsets();
+
+    int sampleRate = 0;
+    int fftSize = 0;
+    int hopSize = 0;
+    int numBars = 0;
+    BarScale barScale = BarScale::Log;
+    long long hops = 0;
+
+    // hops records of numBars bar heights, then the features below
+    std::vector<uint8_t> records;
+    // Onsets up to and including each hop, for AudioFeatures::onsetCount
+    std::vector<unsigned> onsetTotals;
+};
+
+// Where the index for an audio file lives: next to it, as FILE.spec
+std::string spectrogramIndexPath(const char* audioPath);
+
+// Loads the index for a file, or builds and saves it if it is missing or
+// stale. nullptr if the file cannot be read or abort is set.
+SpectrogramIndex* loadSpectrogramIndex(const char* audioPath, const AnalysisConfig& config,
+                                       const std::atomic<bool>& abort);
+
+#endif
@@ -0,0 +1,174 @@
+#include "spectrum.h"
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#elif defined(__ARM_NEON)
+#include <arm_neon.h>
+#endif
+
+static float log2Approx(float x) {
+    uint32_t bits;
+    memcpy(&bits, &x, sizeof(bits));
+    float exponent = float(int((bits >> 23) & 0xFF) - 128);
+    bits = (bits & 0x007FFFFF) | 0x3F800000;
+    float m;
+    memcpy(&m, &bits, sizeof(m));
+    // Quadratic fit of 1 + log2(m) on [1, 2), good to about 0.005; the
+    // exponent is unbiased by 128 instead of 127 to take off the extra 1
+    return exponent + (-0.34484843f * m + 2.02466578f) * m - 0.67487759f;
+}
+
+// power -> log -> scale/offset -> clamp, four bins at a time where possible.
+// Uses the same exponent/mantissa split as log2Approx in every lane.
+static void binsToHeights(const kiss_fft_cpx* bins, float* heights, int count,
+                          float scale, float offset, float maxHeight) {
+    int i = 0;
+#if defined(__SSE2__)
+    const __m128 vScale = _mm_set1_ps(scale);
+    const __m128 vOffset = _mm_set1_ps(offset);
+    const __m128 vMax = _mm_set1_ps(maxHeight);
+    const __m128 vZero = _mm_setzero_ps();
+    const __m128i mantissaMask = _mm_set1_epi32(0x007FFFFF);
+    const __m128i one = _mm_set1_epi32(0x3F800000);
+    const __m128i bias = _mm_set1_epi32(128);
+
+    for (; i + 4 <= count; i += 4) {
+        __m128 lo = _mm_loadu_ps(&bins[i].r);      // r0 i0 r1 i1
+        __m128 hi = _mm_loadu_ps(&bins[i + 2].r);  // r2 i2 r3 i3
+        lo = _mm_mul_ps(lo, lo);
+        hi = _mm_mul_ps(hi, hi);
+        __m128 power = _mm_add_ps(_mm_shuffle_ps(lo, hi, _MM_SHUFFLE(2, 0, 2, 0)),
+                                  _mm_shuffle_ps(lo, hi, _MM_SHUFFLE(3, 1, 3, 1)));
+
+        __m128i bits = _mm_castps_si128(power);
+        __m128 exponent = _mm_cvtepi32_ps(_mm_sub_epi32(_mm_srli_epi32(bits, 23), bias));
+        __m128 m = _mm_castsi128_ps(_mm_or_si128(_mm_and_si128(bits, mantissaMask), one));
+        __m128 log2 = _mm_add_ps(exponent,
+            _mm_sub_ps(_mm_mul_ps(_mm_add_ps(_mm_mul_ps(_mm_set1_ps(-0.34484843f), m),
+                                             _mm_set1_ps(2.02466578f)), m),
+                       _mm_set1_ps(0.67487759f)));
+
+        __m128 h = _mm_add_ps(_mm_mul_ps(log2, vScale), vOffset);
+        _mm_storeu_ps(heights + i, _mm_min_ps(_mm_max_ps(h, vZero), vMax));
+    }
+#elif defined(__ARM_NEON)
+    const float32x4_t vScale = vdupq_n_f32(scale);
+    const float32x4_t vOffset = vdupq_n_f32(offset);
+    const float32x4_t vMax = vdupq_n_f32(maxHeight);
+    const float32x4_t vZero = vdupq_n_f32(0.0f);
+    const uint32x4_t mantissaMask = vdupq_n_u32(0x007FFFFF);
+    const uint32x4_t one = vdupq_n_u32(0x3F800000);
+    const int32x4_t bias = vdupq_n_s32(128);
+
+    for (; i + 4 <= count; i += 4) {
+        float32x4x2_t ri = vld2q_f32(&bins[i].r);  // deinterleaves r and i
+        float32x4_t power = vmlaq_f32(vmulq_f32(ri.val[0], ri.val[0]), ri.val[1], ri.val[1]);
+
+        uint32x4_t bits = vreinterpretq_u32_f32(power);
+        float32x4_t exponent = vcvtq_f32_s32(vsubq_s32(vreinterpretq_s32_u32(vshrq_n_u32(bits, 23)), bias));
+        float32x4_t m = vreinterpretq_f32_u32(vorrq_u32(vandq_u32(bits, mantissaMask), one));
+        float32x4_t poly = vmlaq_f32(vdupq_n_f32(2.02466578f), vdupq_n_f32(-0.34484843f), m);
+        float32x4_t log2 = vaddq_f32(exponent, vsubq_f32(vmulq_f32(poly, m), vdupq_n_f32(0.67487759f)));
+
+        float32x4_t h = vmlaq_f32(vOffset, log2, vScale);
+        vst1q_f32(heights + i, vminq_f32(vmaxq_f32(h, vZero), vMax));
+    }
+#endif
+    for (; i < count; ++i) {
+        float power = bins[i].r * bins[i].r + bins[i].i * bins[i].i;
+        float h = log2Approx(power) * scale + offset;
+        heights[i] = h < 0.0f ? 0.0f : (h > maxHeight ? maxHeight : h);
+    }
+}
+
+SpectrumAnalyzer::SpectrumAnalyzer(int fftSize, WindowType windowType)
+    : fftSize(fftSize),
+      cfg(kiss_fftr_alloc(fftSize, 0, nullptr, nullptr)),
+      window(fftSize),
+      windowed(fftSize),
+      bins(fftSize / 2 + 1) {
+    double windowSum = 0.0;
+    for (int i = 0; i < fftSize; ++i) {
+        double phase = 2.0 * M_PI * i / fftSize;
+        double w = windowType == WindowType::Hann
+                       ? 0.5 - 0.5 * cos(phase)
+                       : 0.42 - 0.5 * cos(phase) + 0.08 * cos(2.0 * phase);
+        window[i] = float(w);
+        windowSum += w;
+    }
+
+    // A full-scale 16-bit sine peaks at 32768 * windowSum / 2 in its bin; that
+    // is 0 dBFS. dB = 10 * log10(power) = 10 * log10(2) * log2(power).
+    const double fullScale = 32768.0 * windowSum / 2.0;
+    const double dbPerLog2 = 10.0 * log10(2.0);
+    const double heightPerDb = maxBarHeight / -floorDb;
+    logScale = float(dbPerLog2 * heightPerDb);
+    logOffset = float((-20.0 * log10(fullScale) - floorDb) * heightPerDb);
+}
+
+SpectrumAnalyzer::~SpectrumAnalyzer() {
+    kiss_fftr_free(cfg);
+}
+
+void SpectrumAnalyzer::analyse(const float* samples, float* heights) {
+    const float* w = window.data();
+    float* out = windowed.data();
+    for (int i = 0; i < fftSize; ++i)
+        out[i] = samples[i] * w[i];
+
+    kiss_fftr(cfg, out, bins.data());
+
+    binsToHeights(bins.data(), heights, fftSize / 2, logScale, logOffset, maxBarHeight);
+}
+
+static double toScale(double hz, BarScale scale) {
+    switch (scale) {
+        case BarScale::Log: return log2(hz);
+        case BarScale::Mel: return 2595.0 * log10(1.0 + hz / 700.0);
+        default: return hz;
+    }
+}
+
+static double fromScale(double value, BarScale scale) {
+    switch (scale) {
+        case BarScale::Log: return exp2(value);
+        case BarScale::Mel: return 700.0 * (pow(10.0, value / 2595.0) - 1.0);
+        default: return value;
+    }
+}
+
+void BarMapping::build(int fftSize, int sampleRate, int numBars, BarScale scale) {
+    const int numBins = fftSize / 2;
+    const double binWidth = double(sampleRate) / fftSize;
+
+    // Linear spans the whole spectrum so numBars == numBins maps bin i to bar i
+    double lo = scale == BarScale::Linear ? 0.0 : minFrequency;
+    double hi = scale == BarScale::Linear ? sampleRate / 2.0 : std::min<double>(maxFrequency, sampleRate / 2.0);
+    double scaledLo = toScale(lo, scale);
+    double scaledHi = toScale(hi, scale);
+
+    edges.resize(numBars + 1);
+    for (int i = 0; i <= numBars; ++i) {
+        double hz = fromScale(scaledLo + (scaledHi - scaledLo) * i / numBars, scale);
+        edges[i] = std::min(numBins, std::max(0, int(hz / binWidth + 0.5)));
+    }
+}
+
+void BarMapping::apply(const float* binHeights, float* bars) const {
+    const int numBars = barCount();
+    const int lastBin = edges[numBars] > 0 ? edges[numBars] - 1 : 0;
+    for (int i = 0; i < numBars; ++i) {
+        // Bars narrower than a bin at the low end reuse the nearest bin
+        int first = std::min(edges[i], lastBin);
+        int end = std::max(edges[i + 1], first + 1);
+
+        float peak = binHeights[first];
+        for (int b = first + 1; b < end; ++b)
+            peak = std::max(peak, binHeights[b]);
+        bars[i] = peak;
+    }
+}
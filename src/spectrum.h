@@ -0,0 +1,58 @@
+#ifndef SPECTRUM_H
+#define SPECTRUM_H
+
+#include <kiss_fftr.h>
+#include <vector>
+
+enum class WindowType { Hann, Blackman };
+enum class BarScale { Linear, Log, Mel };
+
+// Turns one window of mono samples into bar heights: applies a precomputed
+// window, runs a real-input FFT and maps each bin's power onto a log scale.
+// Heights span [0, maxBarHeight] for -60 dBFS .. 0 dBFS.
+class SpectrumAnalyzer {
+public:
+    SpectrumAnalyzer(int fftSize, WindowType window = WindowType::Hann);
+    ~SpectrumAnalyzer();
+
+    SpectrumAnalyzer(const SpectrumAnalyzer&) = delete;
+    SpectrumAnalyzer& operator=(const SpectrumAnalyzer&) = delete;
+
+    // samples holds fftSize frames; heights receives fftSize / 2 values
+    void analyse(const float* samples, float* heights);
+
+    int size() const { return fftSize; }
+
+    static constexpr float maxBarHeight = 3.0f;
+    static constexpr float floorDb = -60.0f;
+
+private:
+    int fftSize;
+    kiss_fftr_cfg cfg;
+    std::vector<float> window;
+    std::vector<float> windowed;
+    std::vector<kiss_fft_cpx> bins;
+
+    // height = logScale * log2(power) + logOffset, before clamping
+    float logScale;
+    float logOffset;
+};
+
+// Precomputed bin-to-bar table. Bar i takes the loudest of bins
+// [edges[i], edges[i + 1]), with the edges spaced evenly on the chosen
+// frequency scale; aggregation is a single pass over the used bins.
+class BarMapping {
+public:
+    void build(int fftSize, int sampleRate, int numBars, BarScale scale);
+    void apply(const float* binHeights, float* bars) const;
+
+    int barCount() const { return (int)edges.size() - 1; }
+
+    static constexpr float minFrequency = 30.0f;
+    static constexpr float maxFrequency = 16000.0f;
+
+private:
+    std::vector<int> edges;
+};
+
+#endif
@@ -0,0 +1,175 @@
+#include "spectrum_feed.h"
+#include <cstring>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+static const char feedMagic[8] = { 'C', 'R', 'S', 'L', 'F', 'E', 'E', 'D' };
+
+static_assert(sizeof(FeedSlot) % 8 == 0, "bars must stay aligned");
+
+// Slots are padded to whole cache lines so neighbours never share one
+static uint32_t slotSizeFor(int numBars) {
+    size_t size = sizeof(FeedSlot) + sizeof(float) * numBars;
+    return uint32_t((size + 63) & ~size_t(63));
+}
+
+static size_t slotsOffset() {
+    return (sizeof(FeedHeader) + 63) & ~size_t(63);
+}
+
+SpectrumFeedWriter::~SpectrumFeedWriter() {
+    close();
+}
+
+bool SpectrumFeedWriter::open(const char* feedName, int numBars, int sampleRate, int fftSize, int hopSize) {
+    close();
+    if (strlen(feedName) >= sizeof(name) || feedName[0] != '/')
+        return false;
+
+    // A fresh object, so readers of a previous run are not handed a new layout
+    shm_unlink(feedName);
+    int fd = shm_open(feedName, O_CREAT | O_EXCL | O_RDWR, 0644);
+    if (fd < 0)
+        return false;
+
+    uint32_t slotSize = slotSizeFor(numBars);
+    size_t total = slotsOffset() + size_t(slotSize) * feedSlotCount;
+    void* data = MAP_FAILED;
+    if (ftruncate(fd, off_t(total)) == 0)
+        data = mmap(nullptr, total, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    ::close(fd);
+    if (data == MAP_FAILED) {
+        shm_unlink(feedName);
+        return false;
+    }
+
+    // ftruncate zeroed everything, so every slot starts at sequence 0
+    header = static_cast<FeedHeader*>(data);
+    header->version = feedVersion;
+    header->slotCount = feedSlotCount;
+    header->slotSize = slotSize;
+    header->numBars = uint32_t(numBars);
+    header->sampleRate = uint32_t(sampleRate);
+    header->fftSize = uint32_t(fftSize);
+    header->hopSize = uint32_t(hopSize);
+    std::atomic_thread_fence(std::memory_order_release);
+    memcpy(header->magic, feedMagic, sizeof(feedMagic));
+
+    strcpy(name, feedName);
+    size = total;
+    return true;
+}
+
+void SpectrumFeedWriter::close() {
+    if (!header)
+        return;
+    munmap(header, size);
+    shm_unlink(name);
+    header = nullptr;
+    size = 0;
+}
+
+FeedSlot* SpectrumFeedWriter::slotAt(uint64_t frame) {
+    char* slots = reinterpret_cast<char*>(header) + slotsOffset();
+    return reinterpret_cast<FeedSlot*>(slots + (frame % feedSlotCount) * header->slotSize);
+}
+
+void SpectrumFeedWriter::beginWrite(FeedSlot* slot, uint64_t frame) {
+    slot->sequence.store(2 * frame + 1, std::memory_order_relaxed);
+    // The odd count must be visible before any of the new contents
+    std::atomic_thread_fence(std::memory_order_release);
+}
+
+void SpectrumFeedWriter::endWrite(FeedSlot* slot, uint64_t frame) {
+    slot->sequence.store(2 * frame + 2, std::memory_order_release);
+    header->published.store(frame + 1, std::memory_order_release);
+}
+
+SpectrumFeedReader::~SpectrumFeedReader() {
+    close();
+}
+
+bool SpectrumFeedReader::open(const char* feedName) {
+    close();
+
+    int fd = shm_open(feedName, O_RDONLY, 0);
+    if (fd < 0)
+        return false;
+
+    struct stat info;
+    void* data = MAP_FAILED;
+    if (fstat(fd, &info) == 0 && size_t(info.st_size) >= slotsOffset())
+        data = mmap(nullptr, size_t(info.st_size), PROT_READ, MAP_SHARED, fd, 0);
+    ::close(fd);
+    if (data == MAP_FAILED)
+        return false;
+
+    header = static_cast<const FeedHeader*>(data);
+    size = size_t(info.st_size);
+
+    // The writer fills the header in before the magic
+    bool valid = memcmp(header->magic, feedMagic, sizeof(feedMagic)) == 0;
+    std::atomic_thread_fence(std::memory_order_acquire);
+    valid = valid && header->version == feedVersion && header->slotCount > 0 &&
+            header->slotSize >= slotSizeFor(int(header->numBars)) &&
+            slotsOffset() + size_t(header->slotSize) * header->slotCount <= size;
+    if (!valid) {
+        close();
+        return false;
+    }
+    return true;
+}
+
+void SpectrumFeedReader::close() {
+    if (header)
+        munmap(const_cast<FeedHeader*>(header), size);
+    header = nullptr;
+    size = 0;
+}
+
+const FeedSlot* SpectrumFeedReader::slotAt(uint64_t frame) const {
+    const char* slots = reinterpret_cast<const char*>(header) + slotsOffset();
+    return reinterpret_cast<const FeedSlot*>(slots + (frame % header->slotCount) * header->slotSize);
+}
+
+size_t SpectrumFeedReader::frameSize() const {
+    return sizeof(FeedSlot) + sizeof(float) * numBars();
+}
+
+const FeedSlot* SpectrumFeedReader::peek(uint64_t frame) const {
+    if (!header)
+        return nullptr;
+    const FeedSlot* slot = slotAt(frame);
+    return slot->sequence.load(std::memory_order_acquire) == 2 * frame + 2 ? slot : nullptr;
+}
+
+bool SpectrumFeedReader::stillValid(uint64_t frame) const {
+    // Everything read from the slot is ordered before this second look
+    std::atomic_thread_fence(std::memory_order_acquire);
+    return slotAt(frame)->sequence.load(std::memory_order_relaxed) == 2 * frame + 2;
+}
+
+bool SpectrumFeedReader::readLatest(FeedSlot* out, uint64_t& frame) const {
+    // A handful of tries: failing means the writer lapped the ring each time
+    for (int attempt = 0; attempt < 4; ++attempt) {
+        uint64_t count = published();
+        if (count == 0)
+            return false;
+
+        frame = count - 1;
+        const FeedSlot* slot = peek(frame);
+        if (!slot)
+            continue;
+
+        // The sequence is left out; it is the one field the writer touches atomically
+        const size_t skip = sizeof(std::atomic<uint64_t>);
+        memcpy(reinterpret_cast<char*>(out) + skip, reinterpret_cast<const char*>(slot) + skip, frameSize() - skip);
+        if (stillValid(frame)) {
+            out->sequence.store(2 * frame + 2, std::memory_order_relaxed);
+            return true;
+        }
+    }
+    return false;
+}
@@ -0,0 +1,123 @@
+#ifndef SPECTRUM_FEED_H
+#define SPECTRUM_FEED_H
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+
+// Analysis frames published through POSIX shared memory, so other local
+// processes (lighting, LED walls) can follow the music without running
+// their own FFT. This file is all a reader needs, together with
+// spectrum_feed.cpp; nothing else from Carousel.
+//
+// The shared object is a header followed by a ring of slots, one frame
+// each. Every slot carries its own sequence counter, which is odd while
+// the writer is filling it in. A reader loads the counter, copies or reads
+// the slot, then loads the counter again; if it changed, the slot was
+// rewritten underneath it and it reads again. Readers never block the
+// writer or each other, and reading costs no system calls.
+
+const char* const defaultFeedName = "/carousel-spectrum";
+const uint32_t feedVersion = 1;
+const uint32_t feedSlotCount = 16;
+
+struct FeedHeader {
+    char magic[8];        // "CRSLFEED", written last
+    uint32_t version;
+    uint32_t slotCount;
+    uint32_t slotSize;    // bytes from one slot to the next
+    uint32_t numBars;
+    uint32_t sampleRate;
+    uint32_t fftSize;
+    uint32_t hopSize;
+    uint32_t reserved;
+    // Frames published so far; the newest is in slot (published - 1) % slotCount
+    std::atomic<uint64_t> published;
+};
+
+struct FeedSlot {
+    // 2n + 1 while frame n is being written, 2n + 2 once it is complete
+    std::atomic<uint64_t> sequence;
+    int64_t position;        // stream frame the analysis window starts at
+    double publishedAt;      // CLOCK_MONOTONIC seconds
+    double capturedAt;       // live input: arrival of its newest samples, else 0
+    float bands[4];          // sub, bass, mid, high; 0..1
+    float onsetStrength;     // of the latest onset, 0..1
+    uint32_t onsetCount;     // onsets so far; compare counts to catch skipped frames
+    float tempo;             // beats per minute, 0 if unknown
+    float tempoConfidence;   // 0..1
+    // numBars floats follow: bar heights, 0..3
+
+    const float* bars() const { return reinterpret_cast<const float*>(this + 1); }
+    float* bars() { return reinterpret_cast<float*>(this + 1); }
+};
+
+static_assert(std::atomic<uint64_t>::is_always_lock_free, "the feed is shared between processes");
+
+// Creates the shared object and publishes into it; Carousel's side
+class SpectrumFeedWriter {
+public:
+    ~SpectrumFeedWriter();
+
+    // Replaces any object left under the same name by an earlier run
+    bool open(const char* name, int numBars, int sampleRate, int fftSize, int hopSize);
+    // Unmaps and unlinks; readers that still have it mapped keep what they see
+    void close();
+    bool isOpen() const { return header != nullptr; }
+
+    // Fills in the next slot; `fill` gets the slot with its bars() to write
+    template <typename Fill>
+    void publish(Fill fill) {
+        uint64_t frame = header->published.load(std::memory_order_relaxed);
+        FeedSlot* slot = slotAt(frame);
+        beginWrite(slot, frame);
+        fill(*slot);
+        endWrite(slot, frame);
+    }
+
+private:
+    FeedSlot* slotAt(uint64_t frame);
+    void beginWrite(FeedSlot* slot, uint64_t frame);
+    void endWrite(FeedSlot* slot, uint64_t frame);
+
+    char name[64] = {};
+    FeedHeader* header = nullptr;
+    size_t size = 0;
+};
+
+// Maps a feed read-only; the reader library
+class SpectrumFeedReader {
+public:
+    ~SpectrumFeedReader();
+
+    bool open(const char* name = defaultFeedName);
+    void close();
+    bool isOpen() const { return header != nullptr; }
+
+    int numBars() const { return header ? int(header->numBars) : 0; }
+    int sampleRate() const { return header ? int(header->sampleRate) : 0; }
+    // Frames published so far; a new frame is there when this changes
+    uint64_t published() const { return header ? header->published.load(std::memory_order_acquire) : 0; }
+
+    // Copies the newest frame into out, which needs sizeof(FeedSlot) +
+    // numBars() floats of room. Sets frame to its number. False if nothing
+    // has been published yet, or the writer kept overwriting it (it would
+    // have to lap the whole ring while one slot is copied).
+    bool readLatest(FeedSlot* out, uint64_t& frame) const;
+
+    // Zero-copy access: the slot frame lives in, to be read in place. It is
+    // only valid if stillValid() returns true after everything has been read.
+    const FeedSlot* peek(uint64_t frame) const;
+    bool stillValid(uint64_t frame) const;
+
+    // Bytes readLatest() writes
+    size_t frameSize() const;
+
+private:
+    const FeedSlot* slotAt(uint64_t frame) const;
+
+    const FeedHeader* header = nullptr;
+    size_t size = 0;
+};
+
+#endif
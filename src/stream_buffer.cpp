@@ -0,0 +1,124 @@
+#include "stream_buffer.h"
+#include <cstring>
+#include <iostream>
+
+StreamBuffer streamBuffer;
+
+bool StreamBuffer::create(GLsizeiptr size) {
+    // Region starts stay aligned for any attribute stride or uniform block offset
+    regionSize = (size + 255) / 256 * 256;
+    const GLsizeiptr totalSize = regionSize * streamRegionCount;
+
+    glGenBuffers(1, &buffer);
+    // Bound to the copy target so creating and mapping never disturbs VAO state
+    glBindBuffer(GL_COPY_WRITE_BUFFER, buffer);
+
+    if (GLAD_GL_VERSION_4_4) {
+        const GLbitfield flags = GL_MAP_WRITE_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT;
+        glBufferStorage(GL_COPY_WRITE_BUFFER, totalSize, nullptr, flags);
+        persistentData = (unsigned char*)glMapBufferRange(GL_COPY_WRITE_BUFFER, 0, totalSize, flags);
+    }
+    if (!persistentData)
+        glBufferData(GL_COPY_WRITE_BUFFER, totalSize, nullptr, GL_STREAM_DRAW);
+
+    glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+    touched[region] = true;
+    return buffer != 0;
+}
+
+void StreamBuffer::destroy() {
+    for (int i = 0; i < streamRegionCount; ++i) {
+        if (fences[i]) {
+            glDeleteSync(fences[i]);
+            fences[i] = nullptr;
+        }
+    }
+    if (buffer) {
+        if (persistentData) {
+            glBindBuffer(GL_COPY_WRITE_BUFFER, buffer);
+            glUnmapBuffer(GL_COPY_WRITE_BUFFER);
+            glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+            persistentData = nullptr;
+        }
+        glDeleteBuffers(1, &buffer);
+        buffer = 0;
+    }
+}
+
+// Moves on to the next region, waiting until the GPU is done with it
+void StreamBuffer::advanceRegion() {
+    region = (region + 1) % streamRegionCount;
+    used = 0;
+    touched[region] = true;
+
+    if (fences[region]) {
+        GLenum result = glClientWaitSync(fences[region], 0, 0);
+        while (result == GL_TIMEOUT_EXPIRED)
+            result = glClientWaitSync(fences[region], GL_SYNC_FLUSH_COMMANDS_BIT, 1000000);
+        glDeleteSync(fences[region]);
+        fences[region] = nullptr;
+    }
+}
+
+void* StreamBuffer::map(GLsizeiptr size, GLsizeiptr alignment, GLintptr& offset) {
+    if (size <= 0 || size > regionSize) {
+        std::cerr << "Stream buffer allocation of " << size << " bytes does not fit\n";
+        return nullptr;
+    }
+
+    GLsizeiptr start = (used + alignment - 1) / alignment * alignment;
+    if (start + size > regionSize) {
+        // Only a frame that outgrew its region gets here
+        advanceRegion();
+        start = 0;
+    }
+    used = start + size;
+    offset = region * regionSize + start;
+
+    if (persistentData)
+        return persistentData + offset;
+
+    glBindBuffer(GL_COPY_WRITE_BUFFER, buffer);
+    void* data = glMapBufferRange(GL_COPY_WRITE_BUFFER, offset, size,
+                                  GL_MAP_WRITE_BIT | GL_MAP_UNSYNCHRONIZED_BIT | GL_MAP_INVALIDATE_RANGE_BIT);
+    glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+    mapped = data != nullptr;
+    return data;
+}
+
+void StreamBuffer::unmap() {
+    if (!mapped)
+        return;
+    glBindBuffer(GL_COPY_WRITE_BUFFER, buffer);
+    glUnmapBuffer(GL_COPY_WRITE_BUFFER);
+    glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+    mapped = false;
+}
+
+GLintptr StreamBuffer::upload(const void* data, GLsizeiptr size, GLsizeiptr alignment) {
+    GLintptr offset;
+    void* dst = map(size, alignment, offset);
+    if (!dst)
+        return -1;
+    memcpy(dst, data, size);
+    unmap();
+    return offset;
+}
+
+void StreamBuffer::endFrame() {
+    if (!buffer)
+        return;
+
+    // Fences go in after the frame's last draw, never mid-frame, so they cover
+    // every command that reads from the regions written this frame
+    for (int i = 0; i < streamRegionCount; ++i) {
+        if (!touched[i])
+            continue;
+        if (fences[i])
+            glDeleteSync(fences[i]);
+        fences[i] = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+        touched[i] = false;
+    }
+    advanceRegion();
+    ++frames;
+}
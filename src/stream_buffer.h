@@ -0,0 +1,58 @@
+#ifndef STREAM_BUFFER_H
+#define STREAM_BUFFER_H
+
+#include <glad/glad.h>
+
+// One GPU buffer that every piece of per-frame data is sub-allocated from.
+//
+// The buffer is split into streamRegionCount regions, used in turn. Each
+// frame writes into a region the GPU finished reading two frames ago, so the
+// writes never wait on the driver: with GL 4.4 the whole buffer stays
+// persistently mapped, otherwise each allocation is mapped unsynchronised.
+// endFrame() fences the regions the frame used; a region is only reused once
+// its fence has passed, which in practice it always has.
+//
+// Data handed out by map() or upload() is valid until the next endFrame().
+const int streamRegionCount = 3;
+
+class StreamBuffer {
+public:
+    // regionSize is the most one frame can write without running into the
+    // next region early
+    bool create(GLsizeiptr regionSize);
+    void destroy();
+
+    // Returns where to write size bytes and their offset in the buffer.
+    // Call unmap() before any GL command reads them.
+    void* map(GLsizeiptr size, GLsizeiptr alignment, GLintptr& offset);
+    void unmap();
+
+    // map(), copy, unmap(); returns the offset, or -1 if size is too large
+    GLintptr upload(const void* data, GLsizeiptr size, GLsizeiptr alignment = 4);
+
+    void endFrame();
+    // Frames ended so far; data handed out under the same number is still valid
+    unsigned long long frameNumber() const { return frames; }
+
+    GLuint id() const { return buffer; }
+    bool persistent() const { return persistentData != nullptr; }
+
+private:
+    void advanceRegion();
+
+    GLuint buffer = 0;
+    GLsizeiptr regionSize = 0;
+    unsigned char* persistentData = nullptr;
+    bool mapped = false;
+
+    int region = 0;
+    GLsizeiptr used = 0;
+    GLsync fences[streamRegionCount] = {};
+    bool touched[streamRegionCount] = {};
+    unsigned long long frames = 0;
+};
+
+// Shared by the renderer, the particles, the frame uniforms and the profiler
+extern StreamBuffer streamBuffer;
+
+#endif
@@ -0,0 +1,103 @@
+// Example consumer of the shared-memory spectrum feed: follows a running
+// `carousel --feed ...` and prints every frame it sees, as a line of
+// features and a coarse bar graph. Any lighting or LED driver reads the
+// feed the same way.
+//
+// Usage: carousel_feed_dump [NAME] [--frames N]
+//
+// NAME defaults to /carousel-spectrum, the name `--feed default` uses.
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <thread>
+#include <vector>
+#include "spectrum_feed.h"
+
+// Bars are folded into this many columns for the terminal
+const int graphColumns = 48;
+
+static double monotonicSeconds() {
+    return std::chrono::duration<double>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+static void printFrame(const FeedSlot& frame, uint64_t number, int numBars, int sampleRate) {
+    static const char levels[] = " .:-=+*#%@";
+
+    char graph[graphColumns + 1];
+    for (int column = 0; column < graphColumns; ++column) {
+        int first = column * numBars / graphColumns;
+        int last = std::max(first + 1, (column + 1) * numBars / graphColumns);
+        float peak = 0.0f;
+        for (int i = first; i < last && i < numBars; ++i)
+            peak = std::max(peak, frame.bars()[i]);
+        graph[column] = levels[std::min(int(peak / 3.0f * 9.0f + 0.5f), 9)];
+    }
+    graph[graphColumns] = '\0';
+
+    double latency = (monotonicSeconds() - frame.publishedAt) * 1000.0;
+    printf("%8llu %9.3fs |%s| bands %.2f %.2f %.2f %.2f onsets %u %5.1f bpm %5.2f ms\n",
+           (unsigned long long)number, double(frame.position) / sampleRate, graph,
+           frame.bands[0], frame.bands[1], frame.bands[2], frame.bands[3],
+           frame.onsetCount, frame.tempo, latency);
+}
+
+int main(int argc, char** argv) {
+    const char* name = defaultFeedName;
+    long long frameLimit = -1;
+    for (int i = 1; i < argc; ++i) {
+        if (strcmp(argv[i], "--frames") == 0 && i + 1 < argc)
+            frameLimit = atoll(argv[++i]);
+        else if (argv[i][0] == '/')
+            name = argv[i];
+        else {
+            fprintf(stderr, "Usage: carousel_feed_dump [NAME] [--frames N]\n");
+            return 1;
+        }
+    }
+
+    SpectrumFeedReader reader;
+    while (!reader.open(name)) {
+        fprintf(stderr, "Waiting for %s...\n", name);
+        std::this_thread::sleep_for(std::chrono::seconds(1));
+    }
+    fprintf(stderr, "%s: %d bars at %d Hz\n", name, reader.numBars(), reader.sampleRate());
+
+    // Room for a slot and its bars, aligned like the slots themselves
+    std::vector<uint64_t> storage((reader.frameSize() + 7) / 8);
+    FeedSlot* frame = reinterpret_cast<FeedSlot*>(storage.data());
+
+    uint64_t lastFrame = UINT64_MAX;
+    long long printed = 0;
+    double lastNewFrame = monotonicSeconds();
+    while (frameLimit < 0 || printed < frameLimit) {
+        // A restarted Carousel creates a new object under the same name
+        if (monotonicSeconds() - lastNewFrame > 2.0) {
+            SpectrumFeedReader fresh;
+            if (fresh.open(name) && fresh.published() != reader.published()) {
+                reader.open(name);
+                storage.assign((reader.frameSize() + 7) / 8, 0);
+                frame = reinterpret_cast<FeedSlot*>(storage.data());
+                lastFrame = UINT64_MAX;
+            }
+            lastNewFrame = monotonicSeconds();
+        }
+
+        // Polling is cheap: nothing but a load until a new frame is published
+        uint64_t number;
+        if (reader.published() != 0 && reader.published() - 1 != lastFrame &&
+            reader.readLatest(frame, number) && number != lastFrame) {
+            if (lastFrame != UINT64_MAX && number > lastFrame + 1)
+                fprintf(stderr, "(skipped %llu)\n", (unsigned long long)(number - lastFrame - 1));
+            printFrame(*frame, number, reader.numBars(), reader.sampleRate());
+            fflush(stdout);
+            lastFrame = number;
+            lastNewFrame = monotonicSeconds();
+            ++printed;
+        }
+        std::this_thread::sleep_for(std::chrono::milliseconds(2));
+    }
+    return 0;
+}